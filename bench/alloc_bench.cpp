@@ -0,0 +1,75 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <tinychain/tinychain.hpp>
+
+using namespace tinychain;
+
+// 区块共享的分配次数基准: 替换全局operator new计数
+// 对比整块深拷贝(原get_last_block的做法)与复制block_ptr，以及遍历交易成员时的分配
+
+namespace {
+
+std::atomic<uint64_t> allocs{0};
+
+const int ROUNDS = 100;
+const int TX_COUNT = 1000;
+
+} // namespace
+
+void* operator new(size_t n) {
+    ++allocs;
+    if (void* p = malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+int main() {
+    block::tx_list_t txs;
+    for (int i = 0; i < TX_COUNT; ++i) {
+        tx::input_t inputs{{hash256(), 0}};
+        tx::output_t outputs{{"1receiveraddress" + std::to_string(i), 10}, {"1changeaddress", 5}};
+        txs.push_back(tx{inputs, outputs});
+    }
+    block b;
+    b.setup(txs);
+    block_ptr shared = std::make_shared<const block>(b);
+
+    uint64_t begin = allocs;
+    for (int i = 0; i < ROUNDS; ++i) {
+        block copy = *shared;
+        (void)copy;
+    }
+    uint64_t deep = (allocs - begin) / ROUNDS;
+
+    begin = allocs;
+    for (int i = 0; i < ROUNDS; ++i) {
+        block_ptr copy = shared;
+        (void)copy;
+    }
+    uint64_t ptr = (allocs - begin) / ROUNDS;
+
+    // 成员访问器返回const引用，遍历不应分配
+    uint64_t items = 0;
+    begin = allocs;
+    for (int i = 0; i < ROUNDS; ++i) {
+        for (auto& each : shared->tx_list()) {
+            items += each.inputs().size() + each.outputs().size();
+        }
+    }
+    uint64_t walk = (allocs - begin) / ROUNDS;
+
+    printf("block with %d txs, allocations per access:\n", TX_COUNT);
+    printf("  deep copy: %llu\n", (unsigned long long)deep);
+    printf("  block_ptr: %llu\n", (unsigned long long)ptr);
+    printf("  tx walk:   %llu (%llu items)\n", (unsigned long long)walk, (unsigned long long)(items / ROUNDS));
+    return 0;
+}
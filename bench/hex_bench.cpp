@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <tinychain/hex.hpp>
+
+using namespace tinychain;
+
+// 十六进制编解码微基准: 一个32字节哈希，对比原sprintf("%02x")/stoull路径与查表/向量路径
+
+namespace {
+
+const int ROUNDS = 1000000;
+
+template <typename F>
+double ns_per_op(F&& f) {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < ROUNDS; ++i) {
+        f(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / ROUNDS;
+}
+
+// 原sha256()的输出方式
+std::string sprintf_encode(const uint8_t* data, size_t len) {
+    char buf[2 * 32 + 1];
+    for (size_t i = 0; i < len; ++i) {
+        sprintf(&buf[i * 2], "%02x", data[i]);
+    }
+    return std::string(buf, 2 * len);
+}
+
+// 原解析方式: 每16个字符一次stoull
+uint64_t stoull_decode(const std::string& hex) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < hex.size(); i += 16) {
+        v ^= std::stoull(hex.substr(i, 16), nullptr, 16);
+    }
+    return v;
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(1);
+    uint8_t hash[32];
+    for (auto& each : hash) {
+        each = uint8_t(rng());
+    }
+    std::string hex = to_hex(hash, sizeof(hash));
+
+    // 结果累加到sink，防止循环被优化掉
+    uint64_t sink = 0;
+    double enc_sprintf = ns_per_op([&](int i) {
+        hash[0] = uint8_t(i);
+        sink += sprintf_encode(hash, sizeof(hash))[1];
+    });
+    double enc_codec = ns_per_op([&](int i) {
+        hash[0] = uint8_t(i);
+        sink += to_hex(hash, sizeof(hash))[1];
+    });
+    double dec_stoull = ns_per_op([&](int i) {
+        hex[0] = "0123456789abcdef"[i & 15];
+        sink += stoull_decode(hex);
+    });
+    uint8_t out[32];
+    double dec_codec = ns_per_op([&](int i) {
+        hex[0] = "0123456789abcdef"[i & 15];
+        sink += from_hex(hex, out, sizeof(out)) ? out[0] : 0;
+    });
+
+    printf("hex backend: %s\n", hex_backend());
+    printf("encode 32 bytes: sprintf %.1f ns, codec %.1f ns\n", enc_sprintf, enc_codec);
+    printf("decode 64 chars: stoull %.1f ns, codec %.1f ns\n", dec_stoull, dec_codec);
+    printf("(sink %llu)\n", (unsigned long long)sink);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <tinychain/tinychain.hpp>
+
+namespace tinychain
+{
+
+struct cache_stats
+{
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+    uint64_t bytes{0};
+    uint64_t capacity{0};
+    uint64_t entries{0};
+
+    Json::Value to_json() const;
+};
+
+// 已解码区块的LRU缓存，命中时只增加引用计数，不拷贝区块，按高度分片，每片一把锁；容量按字节计，每片各占总容量的1/SHARDS
+class block_cache
+{
+public:
+    static const size_t SHARDS = 16;
+
+    block_cache(size_t capacity_bytes = 64u << 20);
+    block_cache(const block_cache&) = delete;
+    block_cache& operator=(const block_cache&) = delete;
+
+    bool get(uint64_t height, block_ptr& out);
+    // encoded_size: 序列化长度，用于估算解码后占用
+    void put(uint64_t height, const block_ptr& b, size_t encoded_size);
+    void set_capacity(size_t capacity_bytes);
+    void clear();
+
+    cache_stats stats() const;
+
+    // 解码后区块的大致内存占用
+    static size_t footprint(const block& b, size_t encoded_size);
+
+private:
+    struct entry
+    {
+        uint64_t height;
+        size_t bytes;
+        block_ptr value;
+    };
+
+    struct shard
+    {
+        mutable std::mutex lock;
+        std::list<entry> lru;     // 表头最近使用
+        std::unordered_map<uint64_t, std::list<entry>::iterator> map;
+        size_t bytes{0};
+        size_t capacity{0};
+    };
+
+    shard& shard_of(uint64_t height) { return shards_[height % SHARDS]; }
+    void evict(shard& s);
+
+    std::vector<shard> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+    std::atomic<uint64_t> evictions_{0};
+};
+
+}// tinychain
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <tinychain/tinychain.hpp>
+#include <tinychain/mempool.hpp>
+
+namespace tinychain
+{
+
+// 待挖区块的交易集合，不含coinbase，按祖先在前的顺序排列
+struct block_template
+{
+    uint64_t height{0};
+    hash256 prev_hash;
+    uint64_t mempool_version{0};
+    uint64_t max_bytes{0};
+    std::vector<mempool_entry> entries;
+    uint64_t fees{0};
+    uint64_t bytes{0};      // 含区块头与coinbase预留
+    uint64_t build_us{0};
+
+    Json::Value to_json() const;
+};
+
+typedef std::shared_ptr<const block_template> block_template_ptr;
+
+// 出块模板: 按祖先包费率从内存池选交易直到字节上限
+// 选中集合在两次取模板之间按内存池的增删记录增量维护(见mempool::update_selection)，只有高费率交易挤不进已满的模板时才整体重选
+// 选择与父块都未变化时直接复用上一个模板，矿工每轮取模板只增加引用计数；变化时把选中交易拷贝成新模板
+class block_assembler
+{
+public:
+    // 区块头、交易计数与区块哈希等定长部分
+    static const uint64_t BLOCK_OVERHEAD = block::HEADER_SIZE + 8 + hash256::SIZE + 4;
+    static const uint64_t COINBASE_RESERVE = 1000;
+
+    block_assembler(const mempool& pool, uint64_t max_bytes = 1000000):pool_(pool), max_bytes_(max_bytes) {}
+    block_assembler(const block_assembler&) = delete;
+    block_assembler& operator=(const block_assembler&) = delete;
+
+    block_template_ptr get(uint64_t height, const hash256& prev_hash);
+
+    void set_max_bytes(uint64_t max_bytes) { max_bytes_ = max_bytes; }
+    uint64_t max_bytes() const { return max_bytes_; }
+
+    uint64_t builds() const { return builds_; }
+    uint64_t updates() const { return updates_; }
+    uint64_t reuses() const { return reuses_; }
+
+private:
+    const mempool& pool_;
+    std::atomic<uint64_t> max_bytes_;
+    std::mutex lock_;
+    block_template_ptr last_;
+    package_selection selection_;
+    std::atomic<uint64_t> builds_{0};
+    std::atomic<uint64_t> updates_{0};
+    std::atomic<uint64_t> reuses_{0};
+};
+
+}// tinychain
@@ -1,25 +1,58 @@
 #pragma once
+#include <map>
 #include <queue>
 #include <tinychain/tinychain.hpp>
 #include <tinychain/database.hpp>
 #include <tinychain/network.hpp>
+#include <tinychain/merkle.hpp>
+#include <tinychain/utxo.hpp>
+#include <tinychain/mempool.hpp>
+#include <tinychain/block_template.hpp>
 
 namespace tinychain
 {
 
+// 启动参数，在打开存储和恢复UTXO集合之前生效
+struct chain_options
+{
+    durability mode{durability::every_block};
+    uint64_t flush_interval_ms{100};        // mode为interval时的落盘间隔
+    uint64_t snapshot_interval{1000};       // 每隔多少个区块写一次UTXO快照，0表示不写
+    size_t block_cache_bytes{64u << 20};
+    size_t mempool_bytes{300u << 20};
+    uint64_t block_max_bytes{1000000};
+};
+
 class blockchain
 {
 public:
     typedef block::tx_list_t memory_pool_t;
-
-    blockchain(uint16_t id = 3721):id_(id) {
-        id_ = id;
-        create_genesis_block();
+    // 链顶变化回调，在push_block成功后、等待落盘前调用，回调中不能再调用push_block
+    typedef std::function<void(const block& tip)> tip_listener;
+
+    // data_dir: 区块存储目录，已有数据时从中恢复链与UTXO集合
+    // 存储打不开或重放失败时ok()为false，此时没有链顶，调用方不能继续启动
+    blockchain(uint16_t id = 3721, const std::string& data_dir = "tinychain_data"):blockchain(chain_options(), id, data_dir) {}
+    blockchain(const chain_options& options, uint16_t id = 3721, const std::string& data_dir = "tinychain_data")
+        :id_(id), data_dir_(data_dir), snapshot_interval_(options.snapshot_interval),
+        pool_(options.mempool_bytes), assembler_(pool_, options.block_max_bytes) {
+        chain_.store().set_durability(options.mode, options.flush_interval_ms);
+        chain_.cache().set_capacity(options.block_cache_bytes);
+        if (!chain_.open(data_dir)) {
+            log::error("blockchain")<<"open block store "<<data_dir<<" failed";
+            return;
+        }
+        if (chain_.height() == 0) {
+            create_genesis_block();
+        } else if (!load()) {
+            log::error("blockchain")<<"replay block store "<<data_dir<<" failed";
+            return;
+        }
+        snapshot_writer_.start(data_dir_);
+        ok_ = true;
     }
-    blockchain(const blockchain&)  = default;
-    blockchain(blockchain&&)  = default;
-    blockchain& operator=(blockchain&&)  = default;
-    blockchain& operator=(const blockchain&)  = default;
+    blockchain(const blockchain&)  = delete;
+    blockchain& operator=(const blockchain&)  = delete;
 
     void print(){
         log::info("blockchain")<<"--------begin--------";
@@ -27,36 +60,68 @@ public:
         log::info("blockchain")<<"--------end--------";
     }
     void test();
+    // 只接受接在链顶上的块(高度与父块哈希)，先把区块整体应用到UTXO集合，成功后再入链；校验失败时链和集合都不变
+    // 先把区块整体应用到UTXO集合，成功后再入链；校验失败时链和集合都不变
+    // 成功后按区块中的txid从内存池移除已打包的交易
+    bool push_block(const block& new_block);
 
-    void push_block(const block& new_block){
-        chain_.push(new_block);
-    }
+    bool ok() const { return ok_; }
 
     uint64_t height() { return chain_.height(); }
 
-    block get_last_block(); 
+    // 返回的编号交给unsubscribe_tip注销，订阅者析构前必须注销
+    uint64_t subscribe_tip(const tip_listener& listener);
+    void unsubscribe_tip(uint64_t id);
+
+    block_ptr get_last_block(); 
+
+    bool get_block(const hash256& block_hash, block_ptr& out);
+    bool get_block(uint64_t height, block_ptr& out);
+
+    bool get_tx(hash256 tx_hash, tx& out);
 
-    bool get_block(sha256_t block_hash, block& out);
+    // 交易所在区块头及merkle证明，SPV客户端只需保存区块头即可验证
+    bool get_tx_proof(const hash256& tx_hash, block::blockheader& header, merkle_proof& proof);
 
-    bool get_tx(sha256_t tx_hash, tx& out);
+    uint64_t get_balance(const address_t& address);
+    address_balance get_address_balance(const address_t& address) { return utxo_.get_balance(address); }
 
-    bool get_balance(address_t address, uint64_t balance);
+    // 输入均为未花费输出，返回手续费
+    bool check_tx(const tx& t, uint64_t& fee) const { return utxo_.check_tx(t, fee); }
+    const utxo_set& utxo() const { return utxo_; }
 
     auto id() {return id_;}
 
-    memory_pool_t pool() { return pool_; }
-    void pool_reset(size_t times) { 
-        //TO FIX, dirty impl
-        while(times--)
-            pool_.erase(pool_.begin());
+    void set_durability(durability mode, uint64_t interval_ms = 100) {
+        chain_.store().set_durability(mode, interval_ms);
     }
+    void set_block_cache(size_t capacity_bytes) { chain_.cache().set_capacity(capacity_bytes); }
+    Json::Value store_info();
 
-    void collect(tx& tx) {
-        pool_.push_back(tx);
-        log::info("blockchain-pool")<<"new tx:"<<tx.to_json().toStyledString();
-    }
+    // 按手续费率从高到低返回全部待打包交易
+    memory_pool_t pool() { return pool_.select(); }
+    const mempool& get_mempool() const { return pool_; }
+    // 内存池内存上限，超出时逐出低费率交易
+    void set_mempool_limit(size_t max_usage);
+    Json::Value mempool_info() const { return pool_.stats().to_json(); }
+
+    // 在当前链顶之上出块的交易模板，内存池与链顶未变时复用上一个
+    block_template_ptr get_block_template() { return get_block_template(get_last_block()); }
+    block_template_ptr get_block_template(const block_ptr& tip);
+    Json::Value block_template_info();
+    void set_block_max_size(uint64_t max_bytes) { assembler_.set_max_bytes(max_bytes); }
+
+    bool collect(tx& tx);
 
     void create_genesis_block();
+    // 从最新的可用UTXO快照恢复，只重放快照之后的区块；没有快照或快照之后重放失败时从头重放
+    // 从头重放也失败时返回false
+    bool load();
+    // 把[from, to)高度的区块依次应用到UTXO集合
+    bool replay(uint64_t from, uint64_t to);
+
+    // 每interval个区块在后台写一次UTXO快照，0表示不写
+    void set_snapshot_interval(uint64_t interval) { snapshot_interval_ = interval; }
 
     key_pair get_new_key_pair(){
         return key_pair_database_.get_new_key_pair();
@@ -70,25 +135,26 @@ public:
         return root;
     }
 
-    Json::Value send(address_t addr, uint64_t amount){
-        Json::Value root;
-        tx target_tx{addr, amount};
-
-        //本地pool
-        collect(target_tx);
-        
-        //广播
-        //ws_send(target_tx.to_json().toStyledString());
-
-        return root;
-    }
+    // 从钱包地址的UTXO中选币，找零回到第一个出资地址
+    Json::Value send(const address_t& addr, uint64_t amount, uint64_t fee = 0);
 
 private:
     uint16_t id_;
+    std::string data_dir_;
+    bool ok_{false};
+    uint64_t snapshot_interval_{1000};
     block genesis_block_;
     chain_database chain_; 
     key_pair_database key_pair_database_;
-    memory_pool_t pool_;
+    mempool pool_;
+    // 串行化交易准入与区块应用，避免校验和入池之间链状态变化
+    std::mutex admission_lock_;
+    block_assembler assembler_;
+    std::mutex listener_lock_;
+    std::map<uint64_t, tip_listener> tip_listeners_;
+    uint64_t next_listener_{0};
+    utxo_set utxo_;
+    utxo_snapshot_writer snapshot_writer_;
 };
 
 }// tinychain
@@ -1,35 +1,138 @@
 #pragma once
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <tinychain/tinychain.hpp>
 #include <tinychain/blockchain.hpp>
+#include <tinychain/merkle.hpp>
 
 namespace tinychain
 {
 
+struct miner_stats
+{
+    size_t threads{0};
+    uint64_t hashes{0};                 // 已尝试的哈希数
+    std::vector<uint64_t> thread_hashes;
+    uint64_t work_units{0};             // 已开始的工作单元(extra nonce)数
+    uint64_t rounds{0};                 // 已开始的PoW轮数，每轮构建一个模板
+    uint64_t template_us{0};            // 模板构建总耗时
+    uint64_t template_max_us{0};
+    uint64_t template_age_ms{0};        // 当前一轮模板已使用的时长
+    uint64_t blocks_found{0};
+    uint64_t blocks_rejected{0};        // 找到但push_block失败
+    uint64_t stale_rounds{0};           // 因链顶变化放弃的轮数
+    uint64_t work_us{0};                // 搜索nonce总耗时
+    uint64_t stale_us{0};               // 其中最终作废的耗时
+
+    double stale_ratio() const { return work_us ? double(stale_us) / work_us : 0.0; }
+    double hashrate() const { return work_us ? hashes * 1e6 / work_us : 0.0; }
+    Json::Value to_json() const;
+};
+
 class miner
 {
 public:
-    miner(blockchain& chain):chain_(chain) {};
-    miner(const miner&) = default;
-    miner(miner&&) = default;
-    miner& operator=(miner&&) = default;
-    miner& operator=(const miner&) = default;
+    // 订阅链顶变化，父块过时时工作线程立即停止当前一轮
+    miner(blockchain& chain):chain_(chain) {
+        tip_subscription_ = chain_.subscribe_tip([this](const block&) {
+                tip_generation_.fetch_add(1, std::memory_order_release);
+                });
+    };
+    ~miner() { chain_.unsubscribe_tip(tip_subscription_); }
+    // 回调捕获了this，不能复制或移动
+    miner(const miner&) = delete;
+    miner(miner&&) = delete;
+    miner& operator=(miner&&) = delete;
+    miner& operator=(const miner&) = delete;
 
     void print(){ std::cout<<"class miner"<<std::endl; }
 
-    //开始挖矿
-    void start(address_t& addr);
+    //开始挖矿, threads为0时使用全部核心；挖矿循环在后台线程运行
+    // 已在挖矿时拒绝再次启动，返回false
+    bool start(const address_t& addr, size_t threads = 0);
+    bool mining() const { return mining_; }
     inline bool pow_once(block& new_block, address_t& addr);
 
-    // 填写自己奖励——coinbase
-    tx create_coinbase_tx(address_t& addr);
+    // 填写自己奖励——coinbase，extra_nonce用于在nonce空间之外产生新的工作单元
+    tx create_coinbase_tx(const address_t& addr, uint64_t height, uint64_t extra_nonce = 0);
+
+    size_t threads() const { return threads_; }
+    // 只读各计数器，不与工作线程争用
+    miner_stats stats() const;
+
+    // 每个工作单元(一个extra nonce)搜索的nonce个数，用完换下一个extra nonce
+    static const uint64_t NONCE_RANGE = uint64_t(1) << 32;
+    // 每搜索这么多个nonce检查一次时间，滚动区块头时间戳
+    static const uint64_t TIMESTAMP_ROLL_INTERVAL = uint64_t(1) << 20;
+    static const size_t MAX_THREADS = 256;
 
 private:
+    // 挖矿主循环: 反复pow_once并把找到的块交给链
+    void run(address_t addr);
+
+    // 一轮挖矿的共享模板，工作线程只读
+    struct pow_work
+    {
+        block base;                 // coinbase(extra nonce为0)在首位的候选块
+        merkle_proof coinbase_path; // coinbase到merkle根的路径
+        address_t addr;
+        uint64_t target{0};
+        uint64_t max_timestamp{0};  // 时间戳滚动上限，保持难度区间不变
+    };
+
+    // 单个工作线程：依次取extra nonce = worker, worker + threads, ...，每个只重算merkle根与midstate
+    // 任一线程找到或链顶变化(generation过时)即全部停止
+    void pow_worker(std::shared_ptr<const pow_work> work, size_t worker, uint64_t generation);
+
+    // 每个工作线程独占一条缓存行，只有该线程写，读者不加锁
+    struct alignas(64) worker_counters
+    {
+        std::atomic<uint64_t> hashes{0};
+        std::atomic<uint64_t> work_units{0};
+    };
+
     blockchain& chain_;
+    uint64_t tip_subscription_{0};
+    std::atomic<size_t> threads_{1};
+    // 主循环只允许一个，工作线程数在启动时确定
+    std::atomic<bool> mining_{false};
+    std::array<worker_counters, MAX_THREADS> counters_;
+
+    std::atomic<bool> found_{false};
+    std::atomic<uint64_t> tip_generation_{0};
+
+    std::atomic<uint64_t> rounds_{0};
+    std::atomic<uint64_t> stale_rounds_{0};
+    std::atomic<uint64_t> work_us_{0};
+    std::atomic<uint64_t> stale_us_{0};
+    // 以下只由挖矿主循环线程写
+    std::atomic<uint64_t> template_us_{0};
+    std::atomic<uint64_t> template_max_us_{0};
+    std::atomic<int64_t> round_begin_us_{0};   // steady_clock，0表示未在挖矿
+    std::atomic<uint64_t> blocks_found_{0};
+    std::atomic<uint64_t> blocks_rejected_{0};
+    std::mutex winner_lock_;
+    block winner_;
 };
 
 
-bool validate_tx(const tx& new_tx) ;
+// 输入均为未花费输出且金额足够
+bool validate_tx(blockchain& chain, const tx& new_tx) ;
+
+// 难度调整: 距父块不超过10秒则加9000，否则减3000
+uint64_t next_difficulty(const block::blockheader& prev, uint64_t timestamp) ;
+// 挖矿目标值: 最大值除以父块难度
+uint64_t pow_target(const block::blockheader& prev) ;
+// 区块头哈希前8字节(大端)，小于目标值即满足工作量
+uint64_t pow_value(const hash256& hash) ;
+
+// 区块头自洽: 哈希与定长区块头一致，merkle根与交易列表一致
+// 且难度按父块正确调整，区块头哈希满足父块难度对应的目标值
+bool validate_block(const block& prev, const block& new_block) ;
 
-bool validate_block(const tx& new_block) ;
+// SPV: 只凭区块头和merkle证明确认交易已被打包
+bool verify_tx_proof(const block::blockheader& header, const hash256& tx_hash, const merkle_proof& proof) ;
 
 }// tinychain
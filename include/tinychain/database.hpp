@@ -1,6 +1,17 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include <tinychain/tinychain.hpp>
-#include <metaverse/mgbubble/utility/Queue.hpp>
+#include <tinychain/tx_index.hpp>
+#include <tinychain/block_cache.hpp>
 
 namespace tinychain
 {
@@ -23,63 +34,192 @@ protected:
 
 };
 
-class chain_database: public Queue<block>
+// 指向映射区内一个已序列化区块的只读视图，不拷贝数据
+struct block_view
+{
+    const uint8_t* data{nullptr};
+    size_t size{0};
+
+    bool decode(block& out) const { return out.decode(data, size); }
+};
+
+// 落盘策略
+//   every_block  每个区块写入后等待落盘再返回，并发写入者共享一次fsync
+//   interval     后台线程每interval_ms把期间写入的区块一起落盘
+//   os           不主动落盘，由操作系统回写，关闭时落盘一次
+enum class durability { every_block, interval, os };
+
+// 组提交统计，延迟为区块写入到落盘完成的时间
+struct commit_stats
+{
+    uint64_t commits{0};
+    uint64_t blocks{0};
+    uint64_t max_batch{0};
+    uint64_t total_latency_us{0};
+    uint64_t max_latency_us{0};
+
+    Json::Value to_json() const;
+};
+
+// 磁盘区块存储:
+//   blocks_NNNNN.dat  只追加的段文件，依次存放序列化区块，每段最大SEGMENT_SIZE
+//   index.dat         定长记录索引，第h条记录即高度h的区块位置(段号, 偏移, 长度)
+// 段文件和索引都mmap映射，读取直接返回映射区内的视图；段文件按最大长度映射，地址不随写入变化
+// 写入只进页缓存，由后台flusher线程按durability策略把一批区块的段文件和索引一次fsync
+// 单写者；读取不加锁: 记录数以release发布，段表预留容量不会搬移，索引扩容后旧映射保留到close
+class block_store : public database
+{
+public:
+    static const size_t SEGMENT_SIZE = 128u << 20;
+    static const size_t MAX_SEGMENTS = 4096;
+    static const size_t RECORD_SIZE = 16;
+    static const size_t HEADER_SIZE = 16;
+    static const uint32_t MAGIC = 0x58494354;   // "TCIX"
+    static const uint32_t VERSION = 1;
+
+    block_store()  {};
+    block_store(const block_store&) = delete;
+    block_store& operator=(const block_store&) = delete;
+    ~block_store();
+
+    void print(){ std::cout<<"class block_store"<<std::endl; }
+
+    // 打开(或创建)目录下的存储，丢弃上次崩溃时未写完整的尾部记录
+    bool open(const std::string& dir);
+    void close();
+
+    // 追加高度为count()的区块，seq为其落盘序号，交给wait_durable等待
+    bool append(const block& b, uint64_t& seq);
+    // every_block策略下阻塞到seq之前的区块都已落盘，其他策略立即返回
+    void wait_durable(uint64_t seq);
+
+    void set_durability(durability mode, uint64_t interval_ms = 100);
+    durability get_durability() const;
+    commit_stats stats() const;
+    bool read(uint64_t height, block_view& view) const;
+    bool get(uint64_t height, block& out) const;
+
+    uint64_t count() const;
+    bool is_open() const { return index_fd_ >= 0; }
+
+    // 立即把已写入的区块连同索引落盘
+    bool flush() override;
+
+private:
+    struct record
+    {
+        uint32_t segment;
+        uint32_t length;
+        uint64_t offset;
+    };
+
+    struct segment
+    {
+        int fd{-1};
+        const uint8_t* map{nullptr};
+    };
+
+    std::string segment_path(uint32_t id) const;
+    bool open_segment(uint32_t id);
+    bool reserve_index(uint64_t records);
+    record get_record(uint64_t height) const;
+    void put_record(uint64_t height, const record& r);
+    void set_count(uint64_t count);
+    void flusher();
+    // 调用时持有lock_，fsync期间释放锁，写入者可继续追加
+    bool sync_batch(std::unique_lock<std::mutex>& lock);
+
+    mutable std::mutex lock_;
+    std::string dir_;
+    std::vector<segment> segments_;
+    uint64_t write_offset_{0};
+
+    int index_fd_{-1};
+    std::atomic<uint8_t*> index_map_{nullptr};
+    size_t index_capacity_{0};  // 可容纳的记录数
+    std::vector<std::pair<uint8_t*, size_t>> retired_maps_;
+    std::atomic<uint64_t> count_{0};
+
+    typedef std::chrono::steady_clock clock_t;
+    std::thread flusher_;
+    std::condition_variable flush_cond_;
+    std::condition_variable durable_cond_;
+    bool stop_{false};
+    durability mode_{durability::every_block};
+    uint64_t interval_ms_{100};
+    uint64_t durable_{0};                   // 已落盘的记录数
+    std::deque<clock_t::time_point> pending_;  // 未落盘区块的写入时间
+    commit_stats stats_;
+};
+
+// 某一时刻的链状态，发布后不再修改；读者拿到后即使写者继续追加也看到一致的高度与链头
+struct chain_view
+{
+    uint64_t version{0};    // 每追加一个区块加一
+    uint64_t count{0};      // 区块数，链头高度为count-1
+    block_ptr tip;
+};
+typedef std::shared_ptr<const chain_view> chain_view_ptr;
+
+// 区块链存储: 区块本身在block_store中，内存只保留哈希索引、交易索引和最近读取区块的LRU缓存
+// 哈希索引与交易索引随区块追加到blockhash.dat/txindex.dat，重启时直接载入，只扫描文件未覆盖的区块
+// 单写者追加；读者不等待写者的磁盘写入:
+//   链头与高度通过原子替换的chain_view读取
+//   哈希/交易索引用读写锁，写者只在插入内存索引时短暂独占
+class chain_database
 {
 public:
-    // thread safty
-    typedef Queue<block> chain_database_t;
-    
     chain_database()  {};
-    chain_database(const chain_database&)  = default;
-    chain_database(chain_database&&)  = default;
-    chain_database& operator=(chain_database&&)  = default;
-    chain_database& operator=(const chain_database&)  = default;
-
-    void print(){
-        for (auto& each : queue_ ) {
-            log::info("block")<<each.to_string();
-        };
-    }
+    ~chain_database();
+    chain_database(const chain_database&)  = delete;
+    chain_database& operator=(const chain_database&)  = delete;
+
+    // 打开磁盘存储，载入索引文件，并由文件未覆盖的区块补建索引
+    bool open(const std::string& dir);
+
+    void print();
     void test();
 
-    uint64_t height() { return count(); }
+    // 追加区块并维护哈希索引与交易索引，区块的存储序号即其高度
+    // 不等待落盘，调用方在释放其他锁后用wait_durable(seq)等待
+    bool push(const block& item, uint64_t& seq);
+    void wait_durable(uint64_t seq) { store_.wait_durable(seq); }
 
-    auto get_last_block() { return queue_.rbegin(); }
+    chain_view_ptr view() const { return std::atomic_load(&view_); }
+    uint64_t height() { return view()->count; }
 
-    bool get_block (const sha256_t block_hash, block& b) {
-        auto iter = std::find_if(queue_.begin(), queue_.end(), [&block_hash](const block& b){
-                return b.hash() == block_hash;
-                });
-        if (iter == queue_.end()) {
-            return false;
-        }
-        b = *iter;
-        return true;
-    }
+    block_ptr get_last_block() { return view()->tip; }
 
-    bool get_tx (const sha256_t tx_hash, tx& t) {
-        auto iter = std::find_if(queue_.begin(), queue_.end(), [&tx_hash, &t](const block& b){
-                auto&& tl = b.tx_list();
-                auto iter2 = std::find_if(tl.begin(), tl.end(), [&tx_hash, &t](const tx& t){
-                return t.hash() == tx_hash;
-                });
-                if (iter2 == tl.end()) { 
-                    return false;
-                } else {
-                    t = *iter2;
-                    return true;
-                }
-
-                });
-        if (iter == queue_.end()) {
-            return false;
-        }
-        return true;
-    }
+    bool get_block (const hash256 block_hash, block_ptr& b);
+    bool get_block (uint64_t height, block_ptr& b);
+    bool get_height (const hash256 block_hash, uint64_t& height);
+
+    // 找到包含该交易的区块，以及交易在区块中的位置
+    bool get_tx_block (const hash256 tx_hash, block_ptr& b, size_t& pos);
+    bool get_tx (const hash256 tx_hash, tx& t);
 
+    bool flush() { return store_.flush(); }
+    block_store& store() { return store_; }
+    block_cache& cache() { return cache_; }
 
 private:
-//    chain_database_t chain_database_;
+    void index_block(const hash256& hash, const std::vector<hash256>& tx_hashes, uint64_t height);
+    void publish(uint64_t count, const block_ptr& tip);
+    // blockhash.dat: 文件头 + 第h条为高度h的区块哈希(32字节)
+    // 载入到第一条空哈希或count为止，最后一条与区块存储核对，不一致则整个重建；covered返回载入条数
+    bool open_hash_file(const std::string& path, uint64_t count, uint64_t& covered);
+    // 按高度定位写入，写失败后不再写
+    void append_hash(const hash256& hash, uint64_t height);
+
+    std::mutex write_lock_;
+    std::shared_timed_mutex index_lock_;
+    chain_view_ptr view_{std::make_shared<chain_view>()};
+    block_store store_;
+    block_cache cache_;
+    // 区块哈希 -> 高度
+    std::unordered_map<hash256, uint64_t> hash_index_;
+    tx_index tx_index_;
+    int hash_fd_{-1};
 };
 
 // 相当于是本地钱包的私钥管理
@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <tinychain/sha256.hpp>
+
+namespace tinychain
+{
+
+// 32字节二进制摘要，可平凡复制；十六进制只在JSON/RPC边界转换
+class hash256
+{
+public:
+    static const size_t SIZE = SHA256::DIGEST_SIZE;
+    typedef std::array<uint8_t, SIZE> bytes_t;
+
+    hash256() { data_.fill(0); }
+    explicit hash256(const bytes_t& bytes):data_(bytes) {}
+    explicit hash256(const uint8_t* bytes) { memcpy(data_.data(), bytes, SIZE); }
+
+    // 64位十六进制 -> hash256，格式不对返回false
+    static bool from_hex(const std::string& hex, hash256& out);
+    std::string to_hex() const;
+
+    const uint8_t* data() const { return data_.data(); }
+    uint8_t* data() { return data_.data(); }
+    static constexpr size_t size() { return SIZE; }
+
+    bool is_null() const {
+        return *this == hash256();
+    }
+
+    // 前8字节按大端解释，PoW目标值比较用
+    uint64_t prefix64() const {
+        uint64_t v = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            v = (v << 8) | data_[i];
+        }
+        return v;
+    }
+
+    // 按大端256位整数与目标值比较
+    bool below(const hash256& target) const { return *this < target; }
+    // 64位目标: 只比较前8字节
+    bool below(uint64_t target) const { return prefix64() < target; }
+
+    bool operator==(const hash256& rh) const { return memcmp(data_.data(), rh.data_.data(), SIZE) == 0; }
+    bool operator!=(const hash256& rh) const { return !(*this == rh); }
+    bool operator<(const hash256& rh) const { return memcmp(data_.data(), rh.data_.data(), SIZE) < 0; }
+
+private:
+    bytes_t data_;
+};
+
+hash256 sha256_hash(const std::string& input);
+hash256 sha256_hash(const uint8_t* data, size_t len);
+
+inline std::ostream& operator<<(std::ostream& out, const hash256& h) {
+    return out << h.to_hex();
+}
+
+}// tinychain
+
+namespace std
+{
+
+// 摘要本身已均匀分布，直接取前8字节
+template <>
+struct hash<tinychain::hash256>
+{
+    size_t operator()(const tinychain::hash256& h) const {
+        size_t v;
+        memcpy(&v, h.data(), sizeof(v));
+        return v;
+    }
+};
+
+}// std
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tinychain
+{
+
+// ---------------------------- 十六进制编解码 ----------------------------
+// 查表标量实现 + ssse3/avx2向量实现，首次使用时按CPUID选择
+
+// out需预留2*len个字符，小写输出
+void hex_encode(const uint8_t* in, size_t len, char* out);
+std::string to_hex(const unsigned char* data, size_t len);
+
+// in为2*len个字符，大小写均可；含非法字符时返回false
+bool hex_decode(const char* in, size_t len, uint8_t* out);
+bool from_hex(const std::string& hex, uint8_t* out, size_t len);
+
+const char* hex_backend();
+
+}// tinychain
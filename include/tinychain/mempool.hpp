@@ -0,0 +1,213 @@
+#pragma once
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <tinychain/tinychain.hpp>
+#include <tinychain/utxo.hpp>
+
+namespace tinychain
+{
+
+// 内存池中的交易及其打包优先级
+struct mempool_entry
+{
+    tx value;
+    uint64_t fee{0};
+    uint64_t size{0};       // 序列化字节数
+    uint64_t usage{0};      // 在内存池中实际占用的内存(含索引节点)
+    uint64_t sequence{0};   // 进入内存池的顺序
+
+    // 连同内存池中全部未确认祖先交易(打包时必须一起进块)的合计
+    uint64_t ancestor_fee{0};
+    uint64_t ancestor_size{0};
+    uint64_t ancestor_count{1};
+
+    // 按每千字节手续费比较，避免浮点
+    uint64_t fee_rate() const { return size ? fee * 1000 / size : 0; }
+    uint64_t ancestor_fee_rate() const { return ancestor_size ? ancestor_fee * 1000 / ancestor_size : 0; }
+};
+
+struct mempool_stats
+{
+    uint64_t count{0};
+    uint64_t bytes{0};          // 交易序列化总长
+    uint64_t usage{0};          // 内存占用
+    uint64_t max_usage{0};
+    uint64_t min_fee_rate{0};   // 当前准入的最低手续费率(每千字节)
+    uint64_t evictions{0};
+    uint64_t rejected{0};       // 因手续费率过低或冲突被拒绝
+    uint64_t replacements{0};   // 被更高费率冲突交易替换
+
+    Json::Value to_json() const;
+};
+
+// 出块选择的增量状态，由block_assembler持有，只经mempool::update_selection修改
+struct package_selection
+{
+    bool valid{false};
+    uint64_t version{0};        // 已应用到的内存池版本
+    uint64_t max_bytes{0};
+    uint64_t bytes{0};
+    bool saturated{false};      // 有包因空间不足未选入，腾出空间后需要补选
+    uint64_t min_score{0};      // 已选包中最低的祖先包费率
+    std::unordered_map<hash256, uint64_t> selected;     // txid -> 序列化长度
+};
+
+enum class selection_update
+{
+    unchanged,
+    incremental,
+    rebuilt
+};
+
+// 内存池: txid哈希索引 + 按手续费率排序的优先级索引 + 输出到花费交易的索引，读写锁保护，可并发插入与读取
+// 同一输出只允许一笔交易花费，冲突交易的费率与总手续费都更高时替换原交易
+// 交易可以花费内存池中其他交易的输出，按祖先包费率另建一个索引供出块选择；移除交易时其后代一并移除
+// 内存占用超过上限时逐出手续费率最低的交易，并把准入最低费率提高到被逐出者之上，随时间按半衰期回落
+class mempool
+{
+public:
+    // 费率单位均为每千字节手续费
+    static const uint64_t INCREMENTAL_FEE_RATE = 10;
+    static const uint64_t FEE_RATE_HALFLIFE = 600;  // 秒
+    static const uint64_t MAX_ANCESTORS = 25;
+    // 任一笔交易连同自身的后代数与总字节数上限，限制替换、逐出和出块移除时遍历的树
+    static const uint64_t MAX_DESCENDANTS = 25;
+    static const uint64_t MAX_DESCENDANT_SIZE = 101000;
+    static const size_t JOURNAL_LIMIT = 16384;
+
+    mempool(size_t max_usage = 300u << 20):max_usage_(max_usage) {}
+    mempool(const mempool&) = delete;
+    mempool& operator=(const mempool&) = delete;
+
+    // 已存在、费率低于准入下限、冲突且不足以替换或放入后即被逐出时返回false
+    // removed: 被替换的冲突交易及为腾出空间被逐出的交易
+    bool add(const tx& t, uint64_t fee, std::vector<tx>& removed);
+    bool contains(const hash256& tx_hash) const;
+    // 花费该输出的内存池交易
+    bool spender(const outpoint& point, hash256& tx_hash) const;
+    // 内存池交易的输出，可作为output_lookup供后代交易校验
+    bool find_output(const outpoint& point, utxo_entry& entry) const;
+    bool get(const hash256& tx_hash, tx& out) const;
+
+    // 按txid移除(连同后代)，返回实际移除的交易
+    std::vector<tx> remove(const std::vector<hash256>& tx_hashes);
+    // 移除区块中已打包的交易(其后代留在池中)，以及与区块交易花费同一输出的冲突交易及其后代
+    // conflicts: 被移除的冲突交易，其待确认状态需由调用方撤销
+    void remove_for_block(const block& b, std::vector<tx>& conflicts);
+
+    // 按优先级(手续费率高、先到)取出，max_count为0表示全部
+    std::vector<tx> select(size_t max_count = 0) const;
+    std::vector<mempool_entry> entries() const;
+
+    // 按祖先包费率从高到低贪心选择，总序列化长度不超过max_bytes，结果中祖先总在后代之前
+    void select_packages(uint64_t max_bytes, std::vector<mempool_entry>& out) const;
+
+    // 按上次应用之后的增删记录更新选择，代价与变化数成正比:
+    //   新交易的包放得下就直接选入；放不下且比已选的最低包更优时才重新选择
+    //   已选交易被移出时扣除其长度，曾因空间不足漏选时从高到低补选，跳过已选的
+    // 变化记录只保留最近JOURNAL_LIMIT条，落后更多或上限改变时整体重选
+    selection_update update_selection(package_selection& sel, uint64_t max_bytes) const;
+    // 已选交易，祖先在前
+    void selected_entries(const package_selection& sel, std::vector<mempool_entry>& out) const;
+    // 每次增删交易递增，用于判断模板是否过期
+    uint64_t version() const;
+
+    // 调小上限时立即逐出超出部分
+    void set_max_usage(size_t max_usage, std::vector<tx>& evicted);
+    uint64_t min_fee_rate() const;
+
+    size_t size() const;
+    mempool_stats stats() const;
+
+    // 单笔交易连同索引节点的内存占用
+    static uint64_t usage_of(const tx& t);
+
+private:
+    typedef std::chrono::steady_clock clock;
+
+    // 优先级键: 手续费率降序，同费率先到先出
+    struct priority_key
+    {
+        uint64_t fee_rate;
+        uint64_t sequence;
+        hash256 tx_hash;
+
+        bool operator<(const priority_key& rh) const {
+            if (fee_rate != rh.fee_rate) {
+                return fee_rate > rh.fee_rate;
+            }
+            return sequence < rh.sequence;
+        }
+    };
+
+    static priority_key key_of(const mempool_entry& e) {
+        return priority_key{e.fee_rate(), e.sequence, e.value.hash()};
+    }
+    static priority_key ancestor_key_of(const mempool_entry& e) {
+        return priority_key{e.ancestor_fee_rate(), e.sequence, e.value.hash()};
+    }
+    typedef std::unordered_map<hash256, mempool_entry>::iterator entry_iter;
+    typedef std::unordered_set<hash256> txid_set;
+
+    // 只移除这一笔，留在池中的后代扣除它的祖先合计
+    bool remove_locked(const hash256& tx_hash, std::vector<tx>& removed);
+    // 移除这一笔及其全部后代，后代集合只算一次
+    void remove_tree_locked(const hash256& tx_hash, std::vector<tx>& removed);
+    // 从各索引删除，不更新其他条目的祖先合计
+    void erase_locked(entry_iter iter, std::vector<tx>& removed);
+    // 以下收集函数按发现顺序追加到out，seen中已有的txid跳过，新收集的同时加入seen
+    void parents_locked(const tx& t, std::vector<hash256>& out, txid_set& seen) const;
+    void ancestors_locked(const tx& t, std::vector<hash256>& out) const;
+    // limit非0时收集到limit个即停止
+    void descendants_locked(const tx& t, std::vector<hash256>& out, txid_set& seen, size_t limit = 0) const;
+    // entry的后代再加上一笔size字节的交易后仍在后代上限之内
+    bool descendants_fit_locked(const mempool_entry& entry, uint64_t size) const;
+    // 收集花费t任一输入的内存池交易txid
+    void conflicts_locked(const tx& t, std::vector<hash256>& out, txid_set& seen) const;
+    void trim_locked(std::vector<tx>& evicted);
+    // 预演放入entry(并替换replaced)后的逐出，新交易或其祖先会被逐出时返回false，不修改内存池
+    bool survives_trim_locked(const mempool_entry& entry, const std::vector<hash256>& replaced,
+        const std::vector<hash256>& ancestors) const;
+    uint64_t min_fee_rate_locked(clock::time_point now) const;
+    // 每次增删一笔: 版本加一并记录变化
+    void record_locked(const hash256& tx_hash, bool added);
+    // 在sel已有选择的基础上按祖先包费率从高到低补选
+    void fill_locked(package_selection& sel) const;
+    // 选入t及其未选的祖先，放不下时返回false
+    bool select_package_locked(package_selection& sel, const mempool_entry& entry) const;
+
+    mutable std::shared_timed_mutex lock_;
+    std::unordered_map<hash256, mempool_entry> by_id_;
+    std::set<priority_key> by_priority_;
+    std::set<priority_key> by_ancestor_score_;
+    std::unordered_map<outpoint, hash256> spenders_;
+    uint64_t next_sequence_{0};
+    uint64_t version_{0};
+
+    struct change
+    {
+        hash256 tx_hash;
+        bool added;
+    };
+    // journal_[i]对应版本 journal_version_ + i
+    std::deque<change> journal_;
+    uint64_t journal_version_{1};
+
+    uint64_t max_usage_;
+    uint64_t usage_{0};
+    uint64_t bytes_{0};
+    uint64_t evictions_{0};
+    uint64_t rejected_{0};
+    uint64_t replacements_{0};
+    // 最近一次逐出时抬高的准入费率及时间
+    uint64_t rolling_min_fee_rate_{0};
+    clock::time_point last_bump_;
+};
+
+}// tinychain
@@ -0,0 +1,29 @@
+#pragma once
+#include <vector>
+#include <tinychain/hash256.hpp>
+
+namespace tinychain
+{
+
+// merkle树: 每层相邻两个节点拼接(64字节)后取sha256，奇数个时复制最后一个；
+// 只有一个叶子时根即为该叶子，空树的根为全0
+hash256 merkle_root(const std::vector<hash256>& leaves);
+
+// 由一层计算上一层，节点较多时分给多个线程，每个线程内走多路SHA-256
+void merkle_next_level(const std::vector<hash256>& level, std::vector<hash256>& next);
+
+// ---------------------------- 包含证明 ----------------------------
+// 叶子到根路径上每层的兄弟节点，index决定每层是左还是右
+struct merkle_proof
+{
+    uint64_t index{0};
+    std::vector<hash256> branch;
+};
+
+bool merkle_branch(const std::vector<hash256>& leaves, size_t index, merkle_proof& proof);
+
+// 只用叶子和证明还原根，O(log n)次哈希，不需要整个区块
+hash256 merkle_root_from_proof(const hash256& leaf, const merkle_proof& proof);
+bool verify_merkle_proof(const hash256& leaf, const merkle_proof& proof, const hash256& root);
+
+}// tinychain
@@ -12,31 +12,42 @@ namespace tinychain
 class node
 {
 public:
-    node()  noexcept {
+    explicit node(const chain_options& options = chain_options())  noexcept:blockchain_(options) {
         log::info("node")<<"node started";
+        if (!sha256_self_test()) {
+            log::error("node")<<"sha256 self test failed";
+        }
+        log::info("node")<<"sha256 backend: "<<SHA256::backend()
+            <<", multi-buffer: "<<sha256_backend()<<" x"<<sha256_lanes();
     }
 
-    node(const node&)  = default;
-    node(node&&)  = default;
-    node& operator=(node&&)  = default;
-    node& operator=(const node&)  = default;
+    node(const node&)  = delete;
+    node(node&&)  = delete;
+    node& operator=(node&&)  = delete;
+    node& operator=(const node&)  = delete;
 
     void test();
     bool check();
+    // 链已就绪，否则不能启动服务
+    bool ok() const { return blockchain_.ok(); }
 
-    void miner_run(address_t address) {
+    // threads: 挖矿线程数，0表示使用全部核心；已在挖矿时返回false
+    bool miner_run(address_t address, size_t threads = 0) {
         // miner
+        if (miner_.mining()) {
+            return false;
+        }
         address_t miner_addr;
         if (address.empty()){
             miner_addr = blockchain_.get_new_key_pair().address();
         } else {
             miner_addr = address;
         }
-        std::thread miner_service(std::bind(&miner::start, &miner_, miner_addr));
-        miner_service.detach();
+        return miner_.start(miner_addr, threads);
     }
 
     blockchain& chain() { return blockchain_; }
+    miner& get_miner() { return miner_; }
     network& p2p() { return network_; }
 
 private:
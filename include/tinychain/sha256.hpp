@@ -1,5 +1,8 @@
 #pragma once
+#include <array>
+#include <cstdint>
 #include <string>
+#include <tinychain/hex.hpp>
 
 namespace tinychain
 {
@@ -11,15 +14,36 @@ protected:
     typedef unsigned int uint32;
     typedef unsigned long long uint64;
  
-    const static uint32 sha256_k[];
     static const unsigned int SHA224_256_BLOCK_SIZE = (512/8);
 public:
+    const static uint32 sha256_k[];
     void init();
     void update(const unsigned char *message, unsigned int len);
     void final(unsigned char *digest);
     static const unsigned int DIGEST_SIZE = ( 256 / 8);
- 
+    static const unsigned int BLOCK_SIZE = SHA224_256_BLOCK_SIZE;
+
+    // 对单个64字节块做压缩，state为8个字的中间状态(midstate)
+    static void compress(uint32_t *state, const unsigned char *block);
+    // 连续压缩多个64字节块，按CPU选择SHA-NI或标量实现
+    static void compress_blocks(uint32_t *state, const unsigned char *data, size_t blocks);
+    static void initial_state(uint32_t *state);
+    // 将中间状态按大端序输出为摘要
+    static void state_to_digest(const uint32_t *state, unsigned char *digest);
+
+    // 当前单消息后端: "sha-ni" 或 "scalar"
+    static const char* backend();
+
+    // 可选后端，compress_blocks只会选用通过自检的那一个
+    typedef void (*compress_blocks_fn)(uint32_t *state, const unsigned char *data, size_t blocks);
+    static void compress_generic(uint32_t *state, const unsigned char *data, size_t blocks);
+    static bool shani_supported();
+    static void compress_shani(uint32_t *state, const unsigned char *data, size_t blocks);
+
 protected:
+    // 选定的后端，整个进程只选一次
+    static compress_blocks_fn select_backend();
+
     void transform(const unsigned char *message, unsigned int block_nb);
     unsigned int m_tot_len;
     unsigned int m_len;
@@ -27,7 +51,26 @@ protected:
     uint32 m_h[8];
 };
  
+typedef std::array<uint8_t, SHA256::DIGEST_SIZE> sha256_digest_t;
+
 std::string sha256(const std::string& input);
+// 标准填充: 0x80 + 0 + 64位大端比特长度，输出为整数个64字节块
+void sha256_pad(const std::string& msg, std::string& out);
+
+// ---------------------- 多路(multi-buffer)SIMD ----------------------
+// 启动时按CPUID选择最宽的内核: avx512f(16路) / avx2(8路) / sse4.1(4路)
+size_t sha256_lanes();
+const char* sha256_backend();
+
+// 多路并行压缩: states为n组各8个字的中间状态，blocks[i]指向第i路的64字节块
+void sha256_compress_many(uint32_t *states, const unsigned char *const *blocks, size_t n);
+
+// 批量哈希相互独立的消息，digests需预留n个
+void sha256_many(const std::string *msgs, size_t n, sha256_digest_t *digests);
+
+// 已知答案自检: 单消息后端、多路内核与标准测试向量逐位一致
+bool sha256_self_test();
+bool sha256_self_test_backend(SHA256::compress_blocks_fn compress_blocks);
  
 #define SHA2_SHFR(x, n)    (x >> n)
 #define SHA2_ROTR(x, n)   ((x >> n) | (x << ((sizeof(x) << 3) - n)))
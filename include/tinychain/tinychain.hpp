@@ -2,8 +2,10 @@
 #include <tinychain/logging.hpp>
 #include <jsoncpp/json/json.h>
 #include <tinychain/sha256.hpp>
+#include <tinychain/hash256.hpp>
 #include <string>
 #include <array>
+#include <memory>
 #include <random>
 #include <sstream>
 
@@ -13,12 +15,16 @@ namespace tinychain
 namespace tc = tinychain;
 
 // ---------------------------- typedef ----------------------------
-typedef std::string sha256_t;
-typedef sha256_t public_key_t;
+typedef std::string public_key_t;
 typedef std::string address_t;
 
+// 每块coinbase奖励
+const uint64_t coinbase_reward = 1000;
+
 // ---------------------------- ulitity ----------------------------
-sha256_t to_sha256(Json::Value jv);
+hash256 to_sha256(Json::Value jv);
+void put_uint64(uint8_t* out, uint64_t value);
+uint64_t get_uint64(const uint8_t* in);
 uint64_t get_now_timestamp();
 uint64_t pseudo_random();
 
@@ -49,7 +55,7 @@ public:
 
     // address 1 开头，截取0~31位公钥
     address_t address() const { return ("1" + public_key_.substr(0, 30)); }
-    sha256_t public_key() const { return public_key_; }
+    public_key_t public_key() const { return public_key_; }
     uint64_t private_key() const { return private_key_; }
 
     Json::Value to_json() const {
@@ -62,51 +68,75 @@ public:
 
 private:
     uint64_t private_key_;
-    sha256_t public_key_;
+    public_key_t public_key_;
 };
 
 class tx
 {
 public:
-    typedef std::pair<sha256_t, uint8_t> input_item_t;
+    typedef std::pair<hash256, uint8_t> input_item_t;
     typedef std::pair<public_key_t, uint64_t> output_item_t;
 
     typedef std::vector<input_item_t> input_t;
     typedef std::vector<output_item_t> output_t;
 
+    // coinbase唯一输入的index，输入hash中写入区块高度，保证各块coinbase的txid不同
+    // 其后8字节为extra nonce，挖矿时改变它即得到新的merkle根
+    static const uint8_t COINBASE_INDEX = 0xff;
+
     tx() {}
-    tx(address_t& address); //coinbase
-    tx(address_t& address, uint64_t amount); 
+    tx(const address_t& address, uint64_t height, uint64_t extra_nonce = 0); //coinbase
+    tx(const input_t& inputs, const output_t& outputs); 
 
-    tx(const tx& rt) {
-       inputs_ = rt.inputs(); 
-       outputs_ = rt.outputs();
-    }
-    tx& operator=(const tx& rt) {
-       inputs_ = rt.inputs(); 
-       outputs_ = rt.outputs();
-       return *this;
-    }
+    tx(const tx&)  = default;
+    tx& operator=(const tx&)  = default;
     tx(tx&&)  = default;
     tx& operator=(tx&&)  = default;
 
     void print(){ std::cout<<"class tx"<<std::endl; }
     void test();
 
-    Json::Value item_to_json (input_item_t in) {
+    Json::Value item_to_json (const input_item_t& in) const {
         Json::Value root;
-        root["hash"] = in.first;
+        root["hash"] = in.first.to_hex();
         root["index"] = in.second;
         return root;
     }
-    Json::Value item_to_json (output_item_t out) {
+    Json::Value item_to_json (const output_item_t& out) const {
         Json::Value root;
         root["address"] = out.first;
         root["value"] = out.second;
         return root;
     }
 
-    Json::Value to_json(){
+    Json::Value to_json() const {
+        auto&& root = body_json();
+        root["hash"] = hash_.to_hex();
+        return root;
+    }
+
+    const input_t& inputs() const { return inputs_; }
+    const output_t& outputs() const { return outputs_; }
+    const hash256& hash() const { return hash_; }
+
+    // 二进制序列化: hash | 输入数 | (hash,index)... | 输出数 | (地址长度,地址,金额)...
+    void encode(std::string& out) const;
+    bool decode(const uint8_t*& in, const uint8_t* end);
+
+    bool is_coinbase() const {
+        return inputs_.size() == 1 && inputs_[0].second == COINBASE_INDEX;
+    }
+    uint64_t output_value() const {
+        uint64_t total = 0;
+        for (auto& each : outputs_) {
+            total += each.second;
+        }
+        return total;
+    }
+
+private:
+    // 交易哈希为不含hash字段的json的sha256
+    Json::Value body_json() const {
         Json::Value root;
 
         Json::Value inputs;
@@ -120,20 +150,13 @@ public:
             outputs.append(item_to_json(each));
         }
         root["outputs"] = outputs;
-        hash_ = to_sha256(root);
-        root["hash"] = hash_;
-
         return root;
     }
+    void rehash() { hash_ = to_sha256(body_json()); }
 
-    input_t inputs() const { return inputs_; }
-    output_t outputs() const { return outputs_; }
-    sha256_t hash() const { return hash_; }
-
-private:
     input_t inputs_;
     output_t outputs_;
-    sha256_t hash_;
+    hash256 hash_;
 };
 
 class block
@@ -147,24 +170,24 @@ public:
         uint64_t timestamp{0};
         uint64_t tx_count{0};
         uint64_t difficulty{0};
-        sha256_t hash;
-        sha256_t merkel_root_hash; //TODO
-        sha256_t prev_hash;
+        hash256 hash;
+        hash256 merkel_root_hash;
+        hash256 prev_hash;
         
     };
 
+    // 定长二进制区块头，作为PoW原像:
+    // [0,32) prev_hash | [32,64) merkel_root_hash | timestamp | difficulty | height | nonce
+    // nonce位于第二个64字节块内，前一个块的midstate每个模板只需计算一次
+    static const size_t HEADER_SIZE = 96;
+    static const size_t NONCE_OFFSET = 88;
+    typedef std::array<uint8_t, HEADER_SIZE> header_bytes_t;
+
 
     block() {}
     block(uint64_t h) {header_.height = h;}
-    block(const block& rb) {
-        header_ = rb.header();
-        tx_list_ = rb.tx_list();
-    }
-    block& operator=(const block& rb) {
-        header_ = rb.header();
-        tx_list_ = rb.tx_list();
-        return *this;
-    }
+    block(const block&)  = default;
+    block& operator=(const block&)  = default;
 
     block(block&&)  = default;
     block& operator=(block&&)  = default;
@@ -172,10 +195,11 @@ public:
     void print(){ std::cout<<"class block"<<std::endl; }
     void test();
 
-    tx_list_t tx_list() const { return tx_list_; }
-    block::blockheader header() const { return header_; }
+    const tx_list_t& tx_list() const { return tx_list_; }
+    const tx& tx_at(size_t pos) const { return tx_list_[pos]; }
+    const block::blockheader& header() const { return header_; }
 
-    Json::Value to_json(){
+    Json::Value to_json() const {
         Json::Value root;
         Json::Value bheader;
 
@@ -184,9 +208,9 @@ public:
         bheader["timestamp"] = header_.timestamp;
         bheader["tx_count"] = header_.tx_count;
         bheader["difficulty"] = header_.difficulty;
-        bheader["hash"] = header_.hash;
-        bheader["merkel_header_hash"] = header_.merkel_root_hash;
-        bheader["prev_hash"] = header_.prev_hash;
+        bheader["hash"] = header_.hash.to_hex();
+        bheader["merkel_header_hash"] = header_.merkel_root_hash.to_hex();
+        bheader["prev_hash"] = header_.prev_hash.to_hex();
 
         root["header"] = bheader;
 
@@ -199,19 +223,33 @@ public:
         return root;
     }
 
-    std::string to_string() {
+    std::string to_string() const {
         auto&& j = to_json();
         return j.toStyledString();
     }
 
-    sha256_t hash() const { return header_.hash; }
+    const hash256& hash() const { return header_.hash; }
 
-    void setup(tx_list_t& txs) {tx_list_.swap(txs);}
+    header_bytes_t header_bytes() const;
+    hash256 header_hash() const;
+
+    // 二进制序列化: 定长区块头 | tx_count | hash | 交易数 | 交易...
+    std::string encode() const;
+    bool decode(const uint8_t* data, size_t size);
+    // 只取区块哈希与交易哈希，跳过其余字段，用于启动时重建索引
+    static bool scan(const uint8_t* data, size_t size, hash256& hash, std::vector<hash256>& tx_hashes);
+
+    // 装载交易，并更新区块头中的merkle根
+    void setup(tx_list_t& txs);
+    std::vector<hash256> tx_hashes() const;
 
     blockheader header_;
 private:
     tx_list_t tx_list_;
 };
 
+// 已入链的区块不可变，各线程共享同一份
+typedef std::shared_ptr<const block> block_ptr;
+
 
 }// tinychain
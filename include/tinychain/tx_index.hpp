@@ -0,0 +1,85 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <tinychain/hash256.hpp>
+
+namespace tinychain
+{
+
+// 交易所在位置: 区块高度 + 区块内序号
+struct tx_location
+{
+    uint64_t height{0};
+    uint32_t position{0};
+};
+
+// 布隆过滤器: 不存在的交易可以不查索引直接返回
+// hash256本身已均匀分布，k个探测位直接由摘要的不同片段组合得到
+class bloom_filter
+{
+public:
+    bloom_filter(size_t capacity = 1 << 16);
+
+    void insert(const hash256& h);
+    bool may_contain(const hash256& h) const;
+
+    size_t capacity() const { return capacity_; }
+    void clear();
+
+private:
+    static const size_t bits_per_item = 10;
+    static const size_t probes = 7;
+
+    size_t capacity_;
+    std::vector<uint64_t> bits_;
+};
+
+// 交易索引: txid -> (高度, 序号)
+// 记录为定长RECORD_SIZE字节，按区块顺序追加到文件，重启时原样读回，不必重新扫描区块
+// 文件不单独落盘，崩溃后丢失或写了一半的尾部由open丢弃，调用方从covered起重新索引
+class tx_index
+{
+public:
+    static const size_t RECORD_SIZE = hash256::SIZE + 8 + 4;
+    static const size_t HEADER_SIZE = 8;
+    static const uint32_t MAGIC = 0x49544354;   // "TCTI"
+    static const uint32_t VERSION = 1;
+
+    tx_index(bool use_bloom = true):use_bloom_(use_bloom) {}
+    ~tx_index();
+    tx_index(const tx_index&) = delete;
+    tx_index& operator=(const tx_index&) = delete;
+
+    // 打开(或创建)记录文件，载入高度小于count的记录
+    // 最后一个高度的记录可能不完整，连同其后的记录一并截掉；covered返回之前已完整载入的区块数
+    bool open(const std::string& path, uint64_t count, uint64_t& covered);
+    // 把一个区块的全部交易追加到文件(只写文件，内存索引由put维护)，写失败后不再追加
+    bool append(const std::vector<hash256>& tx_hashes, uint64_t height);
+    void close();
+
+    void put(const hash256& tx_hash, const tx_location& location);
+    bool get(const hash256& tx_hash, tx_location& location) const;
+    size_t size() const { return index_.size(); }
+
+    static void encode(const hash256& tx_hash, const tx_location& location, uint8_t* out);
+    static void decode(const uint8_t* in, hash256& tx_hash, tx_location& location);
+    // 从连续的定长记录恢复
+    void load(const uint8_t* records, size_t count);
+
+    // 命中过滤器后索引里却没有的次数，用于观察误判率
+    uint64_t bloom_false_positives() const { return bloom_false_positives_.load(std::memory_order_relaxed); }
+
+private:
+    void grow_bloom();
+
+    bool use_bloom_;
+    int fd_{-1};
+    bloom_filter bloom_;
+    std::unordered_map<hash256, tx_location> index_;
+    // get()可在共享锁下并发调用
+    mutable std::atomic<uint64_t> bloom_false_positives_{0};
+};
+
+}// tinychain
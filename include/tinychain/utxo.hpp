@@ -0,0 +1,226 @@
+#pragma once
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <tinychain/tinychain.hpp>
+
+namespace tinychain
+{
+
+// 交易输出的引用: (交易哈希, 输出序号)
+struct outpoint
+{
+    hash256 tx_hash;
+    uint32_t index{0};
+
+    bool operator==(const outpoint& rh) const { return index == rh.index && tx_hash == rh.tx_hash; }
+    bool operator!=(const outpoint& rh) const { return !(*this == rh); }
+};
+
+}// tinychain
+
+namespace std
+{
+
+template <>
+struct hash<tinychain::outpoint>
+{
+    size_t operator()(const tinychain::outpoint& p) const {
+        return hash<tinychain::hash256>()(p.tx_hash) ^ (size_t(p.index) * 0x9e3779b97f4a7c15ULL);
+    }
+};
+
+}// std
+
+namespace tinychain
+{
+
+// 未花费输出，定长88字节，整张表是一块连续内存
+struct utxo_entry
+{
+    static const uint32_t OCCUPIED = 1;
+    static const uint32_t COINBASE = 2;
+
+    hash256 tx_hash;
+    uint32_t index{0};
+    uint32_t flags{0};
+    uint64_t value{0};
+    uint64_t height{0};
+    hash256 owner;      // sha256(地址)
+
+    outpoint point() const { return outpoint{tx_hash, index}; }
+    bool occupied() const { return flags & OCCUPIED; }
+
+    // 快照文件中的定长小端记录
+    static const size_t RECORD_SIZE = 88;
+    void encode(uint8_t* out) const;
+    void decode(const uint8_t* in);
+};
+
+hash256 address_hash(const address_t& address);
+
+// 开放寻址哈希表(线性探测，删除时后移填补空位，无墓碑)，非线程安全
+class utxo_table
+{
+public:
+    utxo_table(size_t capacity = 1024);
+
+    const utxo_entry* find(const outpoint& point) const;
+    bool insert(const utxo_entry& entry);
+    bool erase(const outpoint& point);
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return slots_.size(); }
+    // 预留容量，批量装载时避免反复扩容
+    void reserve(size_t count);
+    void clear();
+
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (auto& each : slots_) {
+            if (each.occupied()) {
+                fn(each);
+            }
+        }
+    }
+
+private:
+    size_t home(const outpoint& point) const;
+    void grow();
+
+    std::vector<utxo_entry> slots_;
+    size_t size_{0};
+    size_t mask_;
+};
+
+// 地址余额: 已确认余额 + pool中待确认的收入与支出
+struct address_balance
+{
+    uint64_t confirmed{0};
+    uint64_t pending_in{0};
+    uint64_t pending_out{0};
+
+    uint64_t unconfirmed() const {
+        return confirmed + pending_in > pending_out ? confirmed + pending_in - pending_out : 0;
+    }
+};
+
+// 查找集合之外的输出(如内存池中未确认交易的输出)，找到时填充金额与所有者
+typedef std::function<bool(const outpoint&, utxo_entry&)> output_lookup;
+
+// UTXO集合: 每个区块先校验再整体提交，失败时集合不变
+// 读写锁: 查询共享；区块校验与commit回调(写存储)期间仍为共享，只有修改内存表时独占
+// 附带 地址 -> {outpoint列表, 余额} 二级索引，查询余额O(1)，列出UTXO为O(该地址输出数)
+class utxo_set
+{
+public:
+    utxo_set()  {};
+
+    // 校验并应用整个区块，任何输入缺失、重复花费或金额不符则整体拒绝
+    // commit在校验通过后、修改集合前调用(如写入区块存储)，返回false时集合不变
+    bool apply_block(const block& b, uint64_t height, const std::function<bool()>& commit = nullptr);
+
+    // 检查交易的每个输入都在集合中，返回手续费
+    // unconfirmed: 不在集合中的输入再从这里查找，用于花费未确认交易的输出
+    bool check_tx(const tx& t, uint64_t& fee, const output_lookup& unconfirmed = nullptr) const;
+
+    // pool收到/移除交易时更新地址的待确认余额，区块入链时其中交易自动移出待确认
+    void add_pending(const tx& t, const output_lookup& unconfirmed = nullptr);
+    void remove_pending(const tx& t);
+    bool pending_spent(const outpoint& point) const;
+
+    bool get(const outpoint& point, utxo_entry& entry) const;
+    uint64_t balance(const address_t& address) const;
+    address_balance get_balance(const address_t& address) const;
+    std::vector<utxo_entry> list(const address_t& address) const;
+    size_t size() const;
+
+    // 最后应用的区块
+    uint64_t tip_height() const;
+    hash256 tip_hash() const;
+
+    // 快照: 导出当前全部条目；从连续的定长记录恢复(清空原有内容和待确认状态)
+    void export_entries(std::vector<utxo_entry>& entries, uint64_t& height, hash256& tip) const;
+    void load(const uint8_t* records, size_t count, uint64_t height, const hash256& tip);
+    void clear();
+
+private:
+    struct address_entry
+    {
+        std::vector<outpoint> points;
+        address_balance balance;
+    };
+
+    struct pending_spend
+    {
+        hash256 owner;
+        uint64_t value;
+    };
+
+    bool check_tx_locked(const tx& t, uint64_t& fee, const output_lookup& unconfirmed) const;
+    void index_add(const utxo_entry& entry);
+    void index_remove(const utxo_entry& entry);
+    void index_release(const hash256& owner);
+    void remove_pending_locked(const tx& t);
+
+    std::mutex apply_lock_;
+    mutable std::shared_timed_mutex lock_;
+    utxo_table table_;
+    std::unordered_map<hash256, address_entry> by_owner_;
+    std::unordered_map<outpoint, pending_spend> pending_spent_;
+    std::unordered_set<hash256> pending_txs_;
+    uint64_t tip_height_{0};
+    hash256 tip_hash_;
+};
+
+// UTXO快照文件 utxo_<高度>.snap:
+//   magic | version | 高度 | 区块哈希 | 条目数 | 定长条目...
+// 先写临时文件并fsync，再原子rename，目录中只保留最新的若干个
+struct utxo_snapshot
+{
+    static const uint32_t MAGIC = 0x53555443;   // "CTUS"
+    static const uint32_t VERSION = 1;
+    static const size_t HEADER_SIZE = 4 + 4 + 8 + hash256::SIZE + 8;
+
+    static bool write(const std::string& dir, uint64_t height, const hash256& tip,
+        const std::vector<utxo_entry>& entries, size_t keep = 2);
+    // mmap快照文件并装入set，返回快照对应的区块高度与哈希
+    static bool load(const std::string& path, utxo_set& set, uint64_t& height, hash256& tip);
+    // 目录中的快照，按高度从新到旧
+    static std::vector<std::string> list(const std::string& dir);
+};
+
+// 后台快照线程: submit只交换待写数据，文件写入在线程中完成；来不及写的旧快照被新的替换
+class utxo_snapshot_writer
+{
+public:
+    utxo_snapshot_writer()  {};
+    utxo_snapshot_writer(const utxo_snapshot_writer&) = delete;
+    utxo_snapshot_writer& operator=(const utxo_snapshot_writer&) = delete;
+    ~utxo_snapshot_writer();
+
+    void start(const std::string& dir);
+    void stop();
+    void submit(uint64_t height, const hash256& tip, std::vector<utxo_entry>&& entries);
+
+private:
+    void run();
+
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::thread thread_;
+    std::string dir_;
+    bool stop_{false};
+    bool has_job_{false};
+    uint64_t height_{0};
+    hash256 tip_;
+    std::vector<utxo_entry> entries_;
+};
+
+}// tinychain
@@ -0,0 +1,102 @@
+#include <tinychain/block_cache.hpp>
+
+namespace tinychain
+{
+
+const size_t block_cache::SHARDS;
+
+Json::Value cache_stats::to_json() const {
+    Json::Value root;
+    root["hits"] = hits;
+    root["misses"] = misses;
+    root["evictions"] = evictions;
+    root["bytes"] = bytes;
+    root["capacity"] = capacity;
+    root["entries"] = entries;
+    root["hit_rate"] = hits + misses ? double(hits) / (hits + misses) : 0.0;
+    return root;
+}
+
+block_cache::block_cache(size_t capacity_bytes):shards_(SHARDS) {
+    set_capacity(capacity_bytes);
+}
+
+size_t block_cache::footprint(const block& b, size_t encoded_size) {
+    // 序列化数据 + 对象本身 + 每笔交易的容器开销
+    return sizeof(block) + encoded_size + b.header_.tx_count * (sizeof(tx) + 64);
+}
+
+bool block_cache::get(uint64_t height, block_ptr& out) {
+    auto& s = shard_of(height);
+    std::unique_lock<std::mutex> lock(s.lock);
+    auto iter = s.map.find(height);
+    if (iter == s.map.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, iter->second);
+    out = iter->second->value;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void block_cache::put(uint64_t height, const block_ptr& b, size_t encoded_size) {
+    size_t bytes = footprint(*b, encoded_size);
+    auto& s = shard_of(height);
+    std::unique_lock<std::mutex> lock(s.lock);
+    if (bytes > s.capacity) {
+        return;
+    }
+    auto iter = s.map.find(height);
+    if (iter != s.map.end()) {
+        s.lru.splice(s.lru.begin(), s.lru, iter->second);
+        return;
+    }
+    s.lru.push_front(entry{height, bytes, b});
+    s.map[height] = s.lru.begin();
+    s.bytes += bytes;
+    evict(s);
+}
+
+void block_cache::evict(shard& s) {
+    while (s.bytes > s.capacity && !s.lru.empty()) {
+        auto& last = s.lru.back();
+        s.bytes -= last.bytes;
+        s.map.erase(last.height);
+        s.lru.pop_back();
+        evictions_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void block_cache::set_capacity(size_t capacity_bytes) {
+    for (auto& s : shards_) {
+        std::unique_lock<std::mutex> lock(s.lock);
+        s.capacity = capacity_bytes / SHARDS;
+        evict(s);
+    }
+}
+
+void block_cache::clear() {
+    for (auto& s : shards_) {
+        std::unique_lock<std::mutex> lock(s.lock);
+        s.lru.clear();
+        s.map.clear();
+        s.bytes = 0;
+    }
+}
+
+cache_stats block_cache::stats() const {
+    cache_stats out;
+    out.hits = hits_.load(std::memory_order_relaxed);
+    out.misses = misses_.load(std::memory_order_relaxed);
+    out.evictions = evictions_.load(std::memory_order_relaxed);
+    for (auto& s : shards_) {
+        std::unique_lock<std::mutex> lock(s.lock);
+        out.bytes += s.bytes;
+        out.capacity += s.capacity;
+        out.entries += s.map.size();
+    }
+    return out;
+}
+
+}// tinychain
@@ -0,0 +1,69 @@
+#include <chrono>
+#include <tinychain/block_template.hpp>
+
+namespace tinychain
+{
+
+const uint64_t block_assembler::BLOCK_OVERHEAD;
+const uint64_t block_assembler::COINBASE_RESERVE;
+
+Json::Value block_template::to_json() const {
+    Json::Value root;
+    root["height"] = height;
+    root["prev_hash"] = prev_hash.to_hex();
+    root["mempool_version"] = mempool_version;
+    root["max_bytes"] = max_bytes;
+    root["bytes"] = bytes;
+    root["fees"] = fees;
+    root["build_us"] = build_us;
+    root["tx_count"] = Json::UInt64(entries.size());
+
+    Json::Value txs(Json::arrayValue);
+    for (auto& each : entries) {
+        Json::Value item;
+        item["hash"] = each.value.hash().to_hex();
+        item["fee"] = each.fee;
+        item["size"] = each.size;
+        item["ancestor_count"] = each.ancestor_count;
+        txs.append(item);
+    }
+    root["txs"] = txs;
+    return root;
+}
+
+block_template_ptr block_assembler::get(uint64_t height, const hash256& prev_hash) {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t max_bytes = max_bytes_;
+    uint64_t reserved = BLOCK_OVERHEAD + COINBASE_RESERVE;
+    auto result = pool_.update_selection(selection_, max_bytes > reserved ? max_bytes - reserved : 0);
+    if (result == selection_update::unchanged && last_ && last_->height == height
+            && last_->prev_hash == prev_hash && last_->max_bytes == max_bytes) {
+        ++reuses_;
+        return last_;
+    }
+    if (result == selection_update::rebuilt) {
+        ++builds_;
+    } else if (result == selection_update::incremental) {
+        ++updates_;
+    }
+
+    auto tmpl = std::make_shared<block_template>();
+    tmpl->height = height;
+    tmpl->prev_hash = prev_hash;
+    tmpl->mempool_version = selection_.version;
+    tmpl->max_bytes = max_bytes;
+    pool_.selected_entries(selection_, tmpl->entries);
+    tmpl->bytes = reserved;
+    for (auto& each : tmpl->entries) {
+        tmpl->fees += each.fee;
+        tmpl->bytes += each.size;
+    }
+    tmpl->build_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - begin).count();
+
+    last_ = tmpl;
+    return last_;
+}
+
+}// tinychain
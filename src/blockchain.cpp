@@ -1,44 +1,291 @@
 #include <tinychain/tinychain.hpp>
 #include <tinychain/blockchain.hpp>
+#include <tinychain/consensus.hpp>
 
 namespace tinychain
 {
 
 void blockchain::test(){}
 
-block blockchain::get_last_block() {
-    return *(chain_.get_last_block());
+block_ptr blockchain::get_last_block() {
+    return chain_.get_last_block();
 }
 
-bool blockchain::get_block(sha256_t block_hash, block& b) {
+bool blockchain::get_block(const hash256& block_hash, block_ptr& b) {
     if (!chain_.get_block(block_hash, b)) {
         return false;
     }
     return true;
 }
 
-bool blockchain::get_balance(address_t address, uint64_t balance){
+bool blockchain::get_block(uint64_t height, block_ptr& b) {
+    return chain_.get_block(height, b);
+}
+
+bool blockchain::push_block(const block& new_block) {
+    // UTXO校验通过后先写入存储，写入失败则UTXO集合也不变
+    uint64_t seq = 0;
+    {
+        std::lock_guard<std::mutex> lock(admission_lock_);
+        // 只接受接在当前链顶上的块，存储、哈希索引与UTXO的高度才能一致
+        uint64_t count = chain_.height();
+        if (new_block.header_.height != count) {
+            log::error("blockchain")<<"reject block "<<new_block.hash()<<": height "
+                <<new_block.header_.height<<" does not extend chain of "<<count;
+            return false;
+        }
+        // 创世块没有父块与交易列表(tx_count为1)，不做区块头与工作量校验
+        if (count > 0) {
+            auto tip = chain_.get_last_block();
+            if (new_block.header_.prev_hash != tip->hash()) {
+                log::error("blockchain")<<"reject block "<<new_block.hash()<<": prev hash is not the tip";
+                return false;
+            }
+            if (!validate_block(*tip, new_block)) {
+                log::error("blockchain")<<"reject block "<<new_block.hash()<<": bad header, merkle root or proof of work";
+                return false;
+            }
+        }
+        if (!utxo_.apply_block(new_block, new_block.header_.height, [&] {
+                    return chain_.push(new_block, seq);
+                    })) {
+            log::error("blockchain")<<"reject block "<<new_block.hash()<<": invalid utxo spend or store failure";
+            return false;
+        }
+        // 已打包交易的待确认状态已由apply_block清除，冲突交易需在此撤销
+        std::vector<tx> conflicts;
+        pool_.remove_for_block(new_block, conflicts);
+        for (auto& each : conflicts) {
+            utxo_.remove_pending(each);
+        }
+    }
+    // 先通知链顶变化，矿工尽快放弃旧父块上的工作
+    {
+        std::lock_guard<std::mutex> lock(listener_lock_);
+        for (auto& each : tip_listeners_) {
+            each.second(new_block);
+        }
+    }
+
+    // 按落盘策略等待组提交，不持有任何锁
+    chain_.wait_durable(seq);
+
+    // 只在此处拷贝条目，编码与写文件在后台线程
+    uint64_t height = new_block.header_.height;
+    if (snapshot_interval_ && height > 0 && height % snapshot_interval_ == 0) {
+        std::vector<utxo_entry> entries;
+        hash256 tip;
+        utxo_.export_entries(entries, height, tip);
+        snapshot_writer_.submit(height, tip, std::move(entries));
+    }
     return true;
 }
 
-bool blockchain::get_tx(sha256_t tx_hash, tx& t) {
+uint64_t blockchain::subscribe_tip(const tip_listener& listener) {
+    std::lock_guard<std::mutex> lock(listener_lock_);
+    tip_listeners_[next_listener_] = listener;
+    return next_listener_++;
+}
+
+void blockchain::unsubscribe_tip(uint64_t id) {
+    std::lock_guard<std::mutex> lock(listener_lock_);
+    tip_listeners_.erase(id);
+}
+
+uint64_t blockchain::get_balance(const address_t& address) {
+    return utxo_.balance(address);
+}
+
+bool blockchain::collect(tx& tx) {
+    std::lock_guard<std::mutex> lock(admission_lock_);
+    if (pool_.contains(tx.hash())) {
+        log::error("blockchain-pool")<<"reject tx "<<tx.hash()<<": already in pool";
+        return false;
+    }
+
+    // 输入可以是内存池中未确认交易的输出
+    auto unconfirmed = [this](const outpoint& point, utxo_entry& entry) {
+        return pool_.find_output(point, entry);
+    };
+    uint64_t fee;
+    if (!utxo_.check_tx(tx, fee, unconfirmed)) {
+        log::error("blockchain-pool")<<"reject tx "<<tx.hash()<<": missing or spent input";
+        return false;
+    }
+
+    // 与pool中已有交易花费同一输出时由内存池决定拒绝或替换
+    std::vector<tinychain::tx> removed;
+    bool added = pool_.add(tx, fee, removed);
+    for (auto& each : removed) {
+        utxo_.remove_pending(each);
+    }
+    if (!added) {
+        return false;
+    }
+    utxo_.add_pending(tx, unconfirmed);
+    log::info("blockchain-pool")<<"new tx:"<<tx.to_json().toStyledString();
+    return true;
+}
+
+Json::Value blockchain::send(const address_t& addr, uint64_t amount, uint64_t fee) {
+    Json::Value root;
+
+    tx::input_t inputs;
+    address_t change_addr;
+    uint64_t total = 0;
+    for (const auto& key : key_pair_database_.list_keys()) {
+        for (auto& each : utxo_.list(key.address())) {
+            if (total >= amount + fee) {
+                break;
+            }
+            // pool中已被花费的输出不能再用
+            if (utxo_.pending_spent(each.point())) {
+                continue;
+            }
+            inputs.push_back(std::make_pair(each.tx_hash, uint8_t(each.index)));
+            total += each.value;
+            if (change_addr.empty()) {
+                change_addr = key.address();
+            }
+        }
+    }
+
+    if (total < amount + fee) {
+        root["error"] = "insufficient balance";
+        return root;
+    }
+
+    tx::output_t outputs;
+    outputs.push_back(std::make_pair(addr, amount));
+    if (total > amount + fee) {
+        outputs.push_back(std::make_pair(change_addr, total - amount - fee));
+    }
+    tx target_tx{inputs, outputs};
+
+    //本地pool
+    if (!collect(target_tx)) {
+        root["error"] = "rejected by memory pool";
+        return root;
+    }
+
+    //广播
+    //ws_send(target_tx.to_json().toStyledString());
+
+    root["tx_hash"] = target_tx.hash().to_hex();
+    return root;
+}
+
+bool blockchain::get_tx(hash256 tx_hash, tx& t) {
     if (!chain_.get_tx(tx_hash, t)) {
         return false;
     }
     return true;
 }
 
+bool blockchain::get_tx_proof(const hash256& tx_hash, block::blockheader& header, merkle_proof& proof) {
+    block_ptr b;
+    size_t pos;
+    if (!chain_.get_tx_block(tx_hash, b, pos)) {
+        return false;
+    }
+    header = b->header();
+    return merkle_branch(b->tx_hashes(), pos, proof);
+}
+
 void blockchain::create_genesis_block() {
 
-    genesis_block_.header_.prev_hash = "0000000000000000000000000000000000000000000000000000000000000000";
+    genesis_block_.header_.prev_hash = hash256();
     genesis_block_.header_.timestamp = get_now_timestamp();
     genesis_block_.header_.tx_count = 1;
     genesis_block_.header_.difficulty = 1;
 
-    genesis_block_.header_.hash = to_sha256(genesis_block_.to_json());
+    genesis_block_.header_.hash = genesis_block_.header_hash();
 
     push_block(genesis_block_);
 }
 
+block_template_ptr blockchain::get_block_template(const block_ptr& tip) {
+    return assembler_.get(tip->header_.height + 1, tip->hash());
+}
+
+Json::Value blockchain::block_template_info() {
+    auto root = get_block_template()->to_json();
+    root["builds"] = assembler_.builds();
+    root["updates"] = assembler_.updates();
+    root["reuses"] = assembler_.reuses();
+    return root;
+}
+
+void blockchain::set_mempool_limit(size_t max_usage) {
+    std::lock_guard<std::mutex> lock(admission_lock_);
+    std::vector<tx> evicted;
+    pool_.set_max_usage(max_usage, evicted);
+    for (auto& each : evicted) {
+        utxo_.remove_pending(each);
+    }
+}
+
+Json::Value blockchain::store_info() {
+    auto& store = chain_.store();
+    Json::Value root;
+    switch (store.get_durability()) {
+        case durability::every_block: root["durability"] = "block"; break;
+        case durability::interval: root["durability"] = "interval"; break;
+        case durability::os: root["durability"] = "os"; break;
+    }
+    root["blocks"] = store.count();
+    root["commit"] = store.stats().to_json();
+    root["cache"] = chain_.cache().stats().to_json();
+    return root;
+}
+
+bool blockchain::load() {
+    uint64_t count = chain_.height();
+    uint64_t from = 0;
+    for (auto& path : utxo_snapshot::list(data_dir_)) {
+        // 快照对应的区块必须仍在链上
+        uint64_t height;
+        hash256 tip;
+        block_ptr b;
+        if (utxo_snapshot::load(path, utxo_, height, tip) && height < count
+                && chain_.get_block(height, b) && b->hash() == tip) {
+            from = height + 1;
+            log::info("blockchain")<<"loaded utxo snapshot "<<path;
+            break;
+        }
+        log::warning("blockchain")<<"skip utxo snapshot "<<path;
+        utxo_.clear();
+    }
+
+    // 快照之后重放失败时丢弃快照从头重放，从头仍失败说明存储已损坏
+    if (!replay(from, count)) {
+        if (from == 0) {
+            return false;
+        }
+        log::warning("blockchain")<<"discard utxo snapshot, replay from height 0";
+        utxo_.clear();
+        from = 0;
+        if (!replay(from, count)) {
+            return false;
+        }
+    }
+    chain_.store().get(0, genesis_block_);
+    log::info("blockchain")<<"loaded "<<count<<" blocks, replayed "<<count - from
+        <<", "<<utxo_.size()<<" unspent outputs";
+    return true;
+}
+
+bool blockchain::replay(uint64_t from, uint64_t to) {
+    // 重放直接读存储，不占用区块缓存
+    for (uint64_t h = from; h < to; ++h) {
+        block b;
+        if (!chain_.store().get(h, b) || !utxo_.apply_block(b, h)) {
+            log::error("blockchain")<<"replay failed at height "<<h;
+            return false;
+        }
+    }
+    return true;
+}
+
 } //tinychain
 
@@ -14,33 +14,102 @@ bool commands::exec(Json::Value& out){
     } else if  (*(vargv_.begin()) == "send") {
         if (vargv_.size() >= 3) {
             uint64_t amount = std::stoul(vargv_[2]);
-            auto ret = node_.chain().send(vargv_[1], amount);
-            out = ret.toStyledString();
+            uint64_t fee = vargv_.size() >= 4 ? std::stoul(vargv_[3]) : 0;
+            out = node_.chain().send(vargv_[1], amount, fee);
         } else {
             out = "incorrect send paramas";
         }
 
     } else if  (*(vargv_.begin()) == "getbalance") {
-        out = "getbalance-ret-not-yet";
+        // 不带地址时统计钱包内全部地址
+        address_balance balance;
+        std::vector<address_t> addrs;
+        if (vargv_.size() >= 2) {
+            addrs.push_back(vargv_[1]);
+        } else {
+            for (const auto& each : node_.chain().list_keys()) {
+                addrs.push_back(each["address"].asString());
+            }
+        }
+        for (auto& each : addrs) {
+            auto&& b = node_.chain().get_address_balance(each);
+            balance.confirmed += b.confirmed;
+            balance.pending_in += b.pending_in;
+            balance.pending_out += b.pending_out;
+        }
+        out["balance"] = balance.confirmed;
+        out["unconfirmed_balance"] = balance.unconfirmed();
+    } else if  (*(vargv_.begin()) == "getblock") {
+        if (vargv_.size() < 2) {
+            out = "incorrect getblock paramas";
+            return false;
+        }
+        // 参数为区块哈希或高度
+        block_ptr b;
+        hash256 block_hash;
+        bool found = hash256::from_hex(vargv_[1], block_hash)
+            ? node_.chain().get_block(block_hash, b)
+            : node_.chain().get_block(uint64_t(std::stoull(vargv_[1])), b);
+        if (!found) {
+            out = "block not found";
+            return false;
+        }
+        out = b->to_json();
+    } else if  (*(vargv_.begin()) == "gettxproof") {
+        hash256 tx_hash;
+        if (vargv_.size() < 2 || !hash256::from_hex(vargv_[1], tx_hash)) {
+            out = "incorrect gettxproof paramas";
+            return false;
+        }
+        block::blockheader header;
+        merkle_proof proof;
+        if (!node_.chain().get_tx_proof(tx_hash, header, proof)) {
+            out = "tx not found";
+            return false;
+        }
+        out["tx_hash"] = tx_hash.to_hex();
+        out["block_hash"] = header.hash.to_hex();
+        out["height"] = header.height;
+        out["merkel_root_hash"] = header.merkel_root_hash.to_hex();
+        out["index"] = proof.index;
+        out["branch"] = Json::arrayValue;
+        for (auto& each : proof.branch) {
+            out["branch"].append(each.to_hex());
+        }
+    } else if  (*(vargv_.begin()) == "getstoreinfo") {
+        out = node_.chain().store_info();
+    } else if  (*(vargv_.begin()) == "getmininginfo") {
+        out = node_.get_miner().stats().to_json();
+        out["height"] = node_.chain().height();
+    } else if  (*(vargv_.begin()) == "getblocktemplate") {
+        out = node_.chain().block_template_info();
+    } else if  (*(vargv_.begin()) == "getmempoolinfo") {
+        out = node_.chain().mempool_info();
     } else if  (*(vargv_.begin()) == "startmining") {
         std::string addr;
+        size_t threads = 0;
+        if (vargv_.size() >= 3) {
+            threads = std::stoul(vargv_[2]);
+        }
         if (vargv_.size() >= 2) {
             addr = vargv_[1];
-            node_.miner_run(addr);
+        }
+        if (!node_.miner_run(addr, threads)) {
+            out["result"] = "already mining with " + std::to_string(node_.get_miner().threads()) + " threads";
+        } else if (!addr.empty()) {
             out["result"] = "start mining on address" + addr;
         } else {
-            node_.miner_run(addr);
             out["result"] = "start mining on your random address: " + addr;
         }
     } else {
-        out = "<getnewkey>  <listkeys>  <getbalance>  <send>  <startmining>";
+        out = "<getnewkey>  <listkeys>  <getbalance>  <send>  <getblock>  <gettxproof>  <getstoreinfo>  <getmempoolinfo>  <getblocktemplate>  <getmininginfo>  <startmining>";
         return false;
     }
 
     return true;
 }
 
-const commands::vargv_t command_list = {"getnewkey","send","getbalance", "startmining"};
+const commands::vargv_t command_list = {"getnewkey","send","getbalance", "getblock", "gettxproof", "getstoreinfo", "getmempoolinfo", "getblocktemplate", "getmininginfo", "startmining"};
 
 
 } //tinychain
@@ -1,13 +1,49 @@
 #include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <tinychain/tinychain.hpp>
 #include <tinychain/consensus.hpp>
 #include <tinychain/blockchain.hpp>
 #include <tinychain/network.hpp>
+#include <tinychain/merkle.hpp>
 
 namespace tinychain
 {
 
-void miner::start(address_t& addr){
+const uint64_t miner::NONCE_RANGE;
+const uint64_t miner::TIMESTAMP_ROLL_INTERVAL;
+const size_t miner::MAX_THREADS;
+
+static int64_t steady_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 单写者计数器，不需要原子的读-改-写
+static void bump(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+bool miner::start(const address_t& addr, size_t threads){
+    bool expected = false;
+    if (!mining_.compare_exchange_strong(expected, true)) {
+        log::error("consensus") << "already mining with " << threads_ << " threads";
+        return false;
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads_ = std::min(threads, MAX_THREADS);
+    log::info("consensus") << "mining with " << threads_ << " threads, sha256 backend: "
+        << sha256_backend() << " x" << sha256_lanes();
+
+    std::thread(&miner::run, this, addr).detach();
+    return true;
+}
+
+void miner::run(address_t addr){
     for(;;) {
         block new_block;
 
@@ -15,97 +51,296 @@ void miner::start(address_t& addr){
         if (!pow_once(new_block, addr)) {
             continue;
         }
+        bump(blocks_found_, 1);
 
-        // 需要在pool中移除已经被打包的交易
-        chain_.pool_reset(new_block.header_.tx_count);
+        // 本地存储，UTXO校验失败则丢弃该块；已打包的交易在push_block中移出pool
+        if (!chain_.push_block(new_block)) {
+            bump(blocks_rejected_, 1);
+            continue;
+        }
 
         // 调用网络广播
         //ws_send(new_block.to_json().toStyledString());
+    }
+}
 
-        // 本地存储
-        chain_.push_block(new_block);
+tx miner::create_coinbase_tx(const address_t& addr, uint64_t height, uint64_t extra_nonce) {
+    return tx{addr, height, extra_nonce};
+}
+
+Json::Value miner_stats::to_json() const {
+    Json::Value root;
+    root["threads"] = Json::UInt64(threads);
+    root["hashes"] = hashes;
+    root["hashrate"] = hashrate();
+    Json::Value per_thread(Json::arrayValue);
+    for (auto& each : thread_hashes) {
+        per_thread.append(Json::UInt64(each));
     }
+    root["thread_hashes"] = per_thread;
+    root["work_units"] = work_units;
+    root["rounds"] = rounds;
+    root["template_us"] = template_us;
+    root["template_avg_us"] = rounds ? double(template_us) / rounds : 0.0;
+    root["template_max_us"] = template_max_us;
+    root["template_age_ms"] = template_age_ms;
+    root["blocks_found"] = blocks_found;
+    root["blocks_rejected"] = blocks_rejected;
+    root["stale_rounds"] = stale_rounds;
+    root["work_us"] = work_us;
+    root["stale_us"] = stale_us;
+    root["stale_ratio"] = stale_ratio();
+    return root;
 }
 
-tx miner::create_coinbase_tx(address_t& addr) {
-    return tx{addr};
+miner_stats miner::stats() const {
+    miner_stats s;
+    s.threads = threads_;
+    for (size_t i = 0; i < MAX_THREADS; ++i) {
+        uint64_t hashes = counters_[i].hashes.load(std::memory_order_relaxed);
+        s.work_units += counters_[i].work_units.load(std::memory_order_relaxed);
+        s.hashes += hashes;
+        if (i < s.threads) {
+            s.thread_hashes.push_back(hashes);
+        }
+    }
+    s.template_us = template_us_;
+    s.template_max_us = template_max_us_;
+    int64_t begin = round_begin_us_;
+    s.template_age_ms = begin ? (steady_now_us() - begin) / 1000 : 0;
+    s.blocks_found = blocks_found_;
+    s.blocks_rejected = blocks_rejected_;
+    s.rounds = rounds_;
+    s.stale_rounds = stale_rounds_;
+    s.work_us = work_us_;
+    s.stale_us = stale_us_;
+    return s;
 }
 
 bool miner::pow_once(block& new_block, address_t& addr) {
 
-    auto&& pool = chain_.pool();
-
-    auto&& prev_block = chain_.get_last_block();
+    // 先记下代数再取链顶，之后任何链顶变化都会让本轮作废
+    uint64_t generation = tip_generation_.load(std::memory_order_acquire);
+    int64_t template_begin = steady_now_us();
+    auto prev_block = chain_.get_last_block();
+    auto tmpl = chain_.get_block_template(prev_block);
 
     // 填充新块
-    new_block.header_.height = prev_block.header_.height + 1;
-    new_block.header_.prev_hash = prev_block.header_.hash;
+    new_block.header_.height = prev_block->header_.height + 1;
+    new_block.header_.prev_hash = prev_block->header_.hash;
 
     new_block.header_.timestamp = get_now_timestamp();
 
-    new_block.header_.tx_count = pool.size();
-
     // 难度调整: 
     // 控制每块速度，控制最快速度，大约10秒
-    uint64_t time_peroid = new_block.header_.timestamp - prev_block.header_.timestamp;
-    //log::info("consensus") << "target:" << ncan;
-
-    if (time_peroid <= 10u) {
-        new_block.header_.difficulty = prev_block.header_.difficulty + 9000;
-    } else {
-        new_block.header_.difficulty = prev_block.header_.difficulty - 3000;
-    }
-    // 计算挖矿目标值,最大值除以难度就目标值
-    uint64_t target = 0xffffffffffffffff / prev_block.header_.difficulty;
-
-    // 设置coinbase交易
-    auto&& tx = create_coinbase_tx(addr);
-    pool.push_back(tx);
-
-    // 装载交易
-    new_block.setup(pool);
-
-    // 计算目标值
-    for ( uint64_t n = 0; ; ++n) {
-        //尝试候选目标值
-        new_block.header_.nonce = n;
-        auto&& jv_block = new_block.to_json();
-        auto&& can = to_sha256(jv_block);
-        uint64_t ncan = std::stoull(can.substr(0, 16), 0, 16); //截断前16位，转换uint64 后进行比较
-
-        // 找到了
-        if (ncan < target) {
-            new_block.header_.hash = can;
-            //log::info("consensus") << "target:" << ncan;
-            //log::info("consensus") << "new block :" << can;
-            log::info("consensus") << "new block :" << jv_block.toStyledString();
-            return true;
-        }
+    uint64_t time_peroid = new_block.header_.timestamp - prev_block->header_.timestamp;
+    new_block.header_.difficulty = next_difficulty(prev_block->header_, new_block.header_.timestamp);
+    uint64_t target = pow_target(prev_block->header_);
+
+    // 装载模板中的交易，coinbase放在首位，其merkle路径只依赖其余交易，每轮算一次
+    block::tx_list_t txs;
+    txs.reserve(tmpl->entries.size() + 1);
+    txs.push_back(create_coinbase_tx(addr, new_block.header_.height));
+    for (auto& each : tmpl->entries) {
+        txs.push_back(each.value);
     }
+    new_block.setup(txs);
 
-    return false;
+    auto work = std::make_shared<pow_work>();
+    work->base = new_block;
+    merkle_branch(new_block.tx_hashes(), 0, work->coinbase_path);
+    work->addr = addr;
+    work->target = target;
+    // 时间戳滚动不越过难度区间，保持填写的难度与出块间隔一致
+    work->max_timestamp = time_peroid <= 10u ? prev_block->header_.timestamp + 10
+        : std::numeric_limits<uint64_t>::max();
+
+    // 每个线程从不同的extra nonce起步，各自拥有独立的coinbase与完整nonce空间
+    found_ = false;
+    int64_t round_begin = steady_now_us();
+    uint64_t template_us = round_begin - template_begin;
+    bump(rounds_, 1);
+    bump(template_us_, template_us);
+    if (template_us > template_max_us_.load(std::memory_order_relaxed)) {
+        template_max_us_.store(template_us, std::memory_order_relaxed);
+    }
+    round_begin_us_.store(round_begin, std::memory_order_relaxed);
+    std::vector<std::thread> workers;
+    workers.reserve(threads_);
+    for (size_t i = 0; i < threads_; ++i) {
+        workers.emplace_back(&miner::pow_worker, this, work, i, generation);
+    }
+    for (auto& each : workers) {
+        each.join();
+    }
+
+    uint64_t elapsed = steady_now_us() - round_begin;
+    bump(work_us_, elapsed);
+    // 找到的块若父块已不是链顶(找到的同时链顶变化)同样作废
+    if (tip_generation_.load(std::memory_order_acquire) != generation) {
+        bump(stale_rounds_, 1);
+        bump(stale_us_, elapsed);
+        log::info("consensus") << "tip changed, dropped " << (found_ ? "found block" : "work")
+            << " on " << new_block.header_.prev_hash << ", stale ratio " << stats().stale_ratio();
+        return false;
+    }
+    if (!found_) {
+        return false;
+    }
+
+    // 找到了
+    std::lock_guard<std::mutex> lock(winner_lock_);
+    new_block = std::move(winner_);
+    log::info("consensus") << "new block :" << new_block.to_json().toStyledString();
+    return true;
 }
 
-bool validate_tx(blockchain& chain, const tx& new_tx) {
-    // input exsited?
-    auto&& inputs = new_tx.inputs();
-    for (auto& each : inputs) {
+void miner::pow_worker(std::shared_ptr<const pow_work> work, size_t worker, uint64_t generation) {
+    auto header = work->base.header_bytes();
+    const size_t time_pos = 64 - SHA256::BLOCK_SIZE;
+    const size_t nonce_pos = block::NONCE_OFFSET - SHA256::BLOCK_SIZE;
+
+    // 第二个块: 头部剩余32字节 + sha256填充，时间戳与nonce在其中
+    unsigned char tail[SHA256::BLOCK_SIZE] = {0};
+    memcpy(tail, header.data() + SHA256::BLOCK_SIZE, block::HEADER_SIZE - SHA256::BLOCK_SIZE);
+    tail[block::HEADER_SIZE - SHA256::BLOCK_SIZE] = 0x80;
+    put_uint64(tail + SHA256::BLOCK_SIZE - 8, 0);
+    tail[SHA256::BLOCK_SIZE - 2] = (block::HEADER_SIZE * 8) >> 8;
+    tail[SHA256::BLOCK_SIZE - 1] = (block::HEADER_SIZE * 8) & 0xff;
+
+    // 每轮用多路SIMD内核同时尝试 lanes 个nonce
+    const size_t lanes = sha256_lanes();
+    std::vector<unsigned char> tails(lanes * SHA256::BLOCK_SIZE);
+    std::vector<const unsigned char*> blocks(lanes);
+    std::vector<uint32_t> states(lanes * 8);
+    for (size_t k = 0; k < lanes; ++k) {
+        memcpy(&tails[k * SHA256::BLOCK_SIZE], tail, SHA256::BLOCK_SIZE);
+        blocks[k] = &tails[k * SHA256::BLOCK_SIZE];
+    }
+
+    auto running = [&] {
+        return !found_.load(std::memory_order_relaxed)
+            && tip_generation_.load(std::memory_order_relaxed) == generation;
+    };
+
+    // 哈希数先在本地累加，滚动时间戳时和退出时写回本线程的计数器
+    auto& counters = counters_[worker];
+    uint64_t hashes = 0;
+    auto flush = [&] {
+        bump(counters.hashes, hashes);
+        hashes = 0;
+    };
 
-        tx pt;
-        if (!chain.get_tx(each.first, pt)) {
-            return false;
+    uint64_t timestamp = work->base.header_.timestamp;
+    for (uint64_t extra_nonce = worker; running(); extra_nonce += threads_) {
+        // 新的工作单元: 只重算coinbase哈希、merkle路径与区块头第一个64字节块的midstate
+        bump(counters.work_units, 1);
+        auto&& coinbase = create_coinbase_tx(work->addr, work->base.header_.height, extra_nonce);
+        auto&& merkle_root = merkle_root_from_proof(coinbase.hash(), work->coinbase_path);
+        memcpy(&header[32], merkle_root.data(), hash256::SIZE);
+        uint32_t midstate[8];
+        SHA256::initial_state(midstate);
+        SHA256::compress(midstate, header.data());
+
+        uint64_t next_roll = 0;
+        for (uint64_t n = 0; n < NONCE_RANGE && running(); ) {
+            // 定期把时间戳滚动到当前时间，只改第二个块
+            if (n >= next_roll) {
+                next_roll = n + TIMESTAMP_ROLL_INTERVAL;
+                flush();
+                uint64_t now = std::min<uint64_t>(get_now_timestamp(), work->max_timestamp);
+                if (now > timestamp) {
+                    timestamp = now;
+                    for (size_t k = 0; k < lanes; ++k) {
+                        put_uint64(&tails[k * SHA256::BLOCK_SIZE + time_pos], timestamp);
+                    }
+                }
+            }
+
+            //尝试候选目标值
+            size_t count = std::min<uint64_t>(lanes, NONCE_RANGE - n);
+            for (size_t k = 0; k < count; ++k) {
+                put_uint64(&tails[k * SHA256::BLOCK_SIZE + nonce_pos], n + k);
+                memcpy(&states[k * 8], midstate, sizeof(midstate));
+            }
+            sha256_compress_many(states.data(), blocks.data(), count);
+            hashes += count;
+
+            for (size_t k = 0; k < count; ++k) {
+                uint64_t ncan = (uint64_t(states[k * 8]) << 32) | states[k * 8 + 1]; //摘要前8字节(大端)，与pow_value一致
+                if (ncan >= work->target) {
+                    continue;
+                }
+
+                // 只有第一个找到的线程提交结果，此时才拼出完整区块
+                bool expected = false;
+                if (found_.compare_exchange_strong(expected, true)) {
+                    block candidate = work->base;
+                    block::tx_list_t txs = candidate.tx_list();
+                    txs[0] = coinbase;
+                    candidate.setup(txs);
+                    candidate.header_.timestamp = timestamp;
+                    candidate.header_.nonce = n + k;
+                    candidate.header_.hash = candidate.header_hash();
+                    std::lock_guard<std::mutex> lock(winner_lock_);
+                    winner_ = std::move(candidate);
+                }
+                flush();
+                return;
+            }
+            n += count;
         }
+    }
+    flush();
+}
 
-        log::info("consensus")<<pt.to_json().toStyledString();
-        //auto&& tl = pt.outputs();
+bool validate_tx(blockchain& chain, const tx& new_tx) {
+    // 每个输入在UTXO集合中O(1)查找，且输入总额不小于输出
+    uint64_t fee;
+    return chain.check_tx(new_tx, fee);
+}
+
+uint64_t next_difficulty(const block::blockheader& prev, uint64_t timestamp) {
+    if (timestamp - prev.timestamp <= 10u) {
+        return prev.difficulty + 9000;
     }
+    return prev.difficulty - 3000;
+}
 
-    return true;
+uint64_t pow_target(const block::blockheader& prev) {
+    return 0xffffffffffffffff / std::max<uint64_t>(prev.difficulty, 1);
 }
 
-bool validate_block(const tx& new_block) {
+uint64_t pow_value(const hash256& hash) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        value = (value << 8) | hash.data()[i];
+    }
+    return value;
+}
 
-    return true;
+bool validate_block(const block& prev, const block& new_block) {
+    auto&& header = new_block.header();
+    if (new_block.header_hash() != header.hash) {
+        return false;
+    }
+    if (header.difficulty != next_difficulty(prev.header(), header.timestamp)) {
+        return false;
+    }
+    if (pow_value(header.hash) >= pow_target(prev.header())) {
+        return false;
+    }
+    if (header.tx_count != new_block.tx_list().size()) {
+        return false;
+    }
+    return merkle_root(new_block.tx_hashes()) == header.merkel_root_hash;
+}
+
+bool verify_tx_proof(const block::blockheader& header, const hash256& tx_hash, const merkle_proof& proof) {
+    if (proof.index >= header.tx_count) {
+        return false;
+    }
+    return verify_merkle_proof(tx_hash, proof, header.merkel_root_hash);
 }
 
 
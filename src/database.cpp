@@ -1,3 +1,10 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <tinychain/tinychain.hpp>
 #include <tinychain/database.hpp>
 
@@ -7,6 +14,618 @@ namespace tinychain
 
 void database::test(){}
 
+// ---------------------------- block_store ----------------------------
 
-} //tinychain
+const size_t block_store::SEGMENT_SIZE;
+const size_t block_store::MAX_SEGMENTS;
+const size_t block_store::RECORD_SIZE;
+const size_t block_store::HEADER_SIZE;
+const uint32_t block_store::MAGIC;
+const uint32_t block_store::VERSION;
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+    return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+static bool write_all(int fd, const void* data, size_t size, uint64_t offset) {
+    auto p = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::pwrite(fd, p, size, offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+block_store::~block_store() {
+    close();
+}
+
+std::string block_store::segment_path(uint32_t id) const {
+    char name[32];
+    snprintf(name, sizeof(name), "/blocks_%05u.dat", id);
+    return dir_ + name;
+}
+
+bool block_store::open_segment(uint32_t id) {
+    if (segments_.size() >= MAX_SEGMENTS) {
+        log::error("block_store")<<"too many segments";
+        return false;
+    }
+    auto&& path = segment_path(id);
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        log::error("block_store")<<"open "<<path<<" failed: "<<strerror(errno);
+        return false;
+    }
+    // 按最大长度映射，超出文件长度的部分不会被访问
+    void* map = ::mmap(nullptr, SEGMENT_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        log::error("block_store")<<"mmap "<<path<<" failed: "<<strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    segments_.push_back(segment{fd, static_cast<const uint8_t*>(map)});
+    return true;
+}
+
+bool block_store::reserve_index(uint64_t records) {
+    if (records <= index_capacity_) {
+        return true;
+    }
+    size_t capacity = index_capacity_ ? index_capacity_ : 4096;
+    while (capacity < records) {
+        capacity *= 2;
+    }
+    size_t bytes = HEADER_SIZE + capacity * RECORD_SIZE;
+    if (::ftruncate(index_fd_, bytes) != 0) {
+        log::error("block_store")<<"grow index failed: "<<strerror(errno);
+        return false;
+    }
+    void* map = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd_, 0);
+    if (map == MAP_FAILED) {
+        log::error("block_store")<<"mmap index failed: "<<strerror(errno);
+        return false;
+    }
+    // 读者可能还在用旧映射，保留到close；同一文件的共享映射，新旧内容一致
+    auto old = index_map_.exchange(static_cast<uint8_t*>(map), std::memory_order_acq_rel);
+    if (old != nullptr) {
+        retired_maps_.push_back(std::make_pair(old, HEADER_SIZE + index_capacity_ * RECORD_SIZE));
+    }
+    index_capacity_ = capacity;
+    return true;
+}
+
+block_store::record block_store::get_record(uint64_t height) const {
+    const uint8_t* p = index_map_.load(std::memory_order_acquire) + HEADER_SIZE + height * RECORD_SIZE;
+    return record{get_u32(p), get_u32(p + 4), get_uint64(p + 8)};
+}
+
+void block_store::put_record(uint64_t height, const record& r) {
+    uint8_t* p = index_map_.load(std::memory_order_relaxed) + HEADER_SIZE + height * RECORD_SIZE;
+    put_u32(p, r.segment);
+    put_u32(p + 4, r.length);
+    put_uint64(p + 8, r.offset);
+}
+
+void block_store::set_count(uint64_t count) {
+    put_uint64(index_map_.load(std::memory_order_relaxed) + 8, count);
+    count_.store(count, std::memory_order_release);
+}
+
+bool block_store::open(const std::string& dir) {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (index_fd_ >= 0) {
+        return true;
+    }
+    dir_ = dir;
+    segments_.reserve(MAX_SEGMENTS);
+    if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        log::error("block_store")<<"mkdir "<<dir<<" failed: "<<strerror(errno);
+        return false;
+    }
+
+    auto&& index_path = dir_ + "/index.dat";
+    index_fd_ = ::open(index_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (index_fd_ < 0) {
+        log::error("block_store")<<"open "<<index_path<<" failed: "<<strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (::fstat(index_fd_, &st) != 0) {
+        return false;
+    }
+    bool fresh = size_t(st.st_size) < HEADER_SIZE;
+    uint64_t existing = fresh ? 0 : (st.st_size - HEADER_SIZE) / RECORD_SIZE;
+    if (!reserve_index(std::max<uint64_t>(existing, 1))) {
+        return false;
+    }
+
+    uint8_t* header = index_map_.load();
+    if (fresh) {
+        put_u32(header, MAGIC);
+        put_u32(header + 4, VERSION);
+        set_count(0);
+    } else if (get_u32(header) != MAGIC || get_u32(header + 4) != VERSION) {
+        log::error("block_store")<<index_path<<": bad magic or version";
+        return false;
+    }
+    uint64_t count = std::min<uint64_t>(get_uint64(header + 8), index_capacity_);
+
+    // 逐段打开，并检查尾部记录是否完整写入了段文件
+    uint32_t last_segment = count ? get_record(count - 1).segment : 0;
+    for (uint32_t id = 0; id <= last_segment; ++id) {
+        if (!open_segment(id)) {
+            return false;
+        }
+    }
+    while (count > 0) {
+        auto&& r = get_record(count - 1);
+        if (::fstat(segments_[r.segment].fd, &st) == 0 && r.offset + r.length <= uint64_t(st.st_size)) {
+            break;
+        }
+        log::warning("block_store")<<"drop incomplete block at height "<<count - 1;
+        --count;
+    }
+    set_count(count);
+
+    // 截掉最后一条记录之后未被索引的数据，后续从该处追加
+    if (count > 0) {
+        auto&& r = get_record(count - 1);
+        write_offset_ = r.offset + r.length;
+        while (segments_.size() > r.segment + 1) {
+            ::munmap(const_cast<uint8_t*>(segments_.back().map), SEGMENT_SIZE);
+            ::close(segments_.back().fd);
+            segments_.pop_back();
+        }
+    } else {
+        write_offset_ = 0;
+    }
+    if (::ftruncate(segments_.back().fd, write_offset_) != 0) {
+        log::warning("block_store")<<"truncate segment failed: "<<strerror(errno);
+    }
+
+    durable_ = count_;
+    stop_ = false;
+    flusher_ = std::thread(&block_store::flusher, this);
+
+    log::info("block_store")<<"opened "<<dir_<<" with "<<count_<<" blocks in "<<segments_.size()<<" segments";
+    return true;
+}
+
+void block_store::close() {
+    // 先停flusher，它退出前会把剩余区块落盘
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    flush_cond_.notify_all();
+    if (flusher_.joinable()) {
+        flusher_.join();
+    }
+
+    std::unique_lock<std::mutex> lock(lock_);
+    for (auto& each : segments_) {
+        ::fdatasync(each.fd);
+        ::munmap(const_cast<uint8_t*>(each.map), SEGMENT_SIZE);
+        ::close(each.fd);
+    }
+    segments_.clear();
+    uint8_t* map = index_map_.exchange(nullptr);
+    if (map != nullptr) {
+        ::msync(map, HEADER_SIZE + index_capacity_ * RECORD_SIZE, MS_SYNC);
+        ::munmap(map, HEADER_SIZE + index_capacity_ * RECORD_SIZE);
+        index_capacity_ = 0;
+    }
+    for (auto& each : retired_maps_) {
+        ::munmap(each.first, each.second);
+    }
+    retired_maps_.clear();
+    count_.store(0);
+    if (index_fd_ >= 0) {
+        ::close(index_fd_);
+        index_fd_ = -1;
+    }
+}
+
+bool block_store::append(const block& b, uint64_t& seq) {
+    auto&& data = b.encode();
+    if (data.size() > SEGMENT_SIZE) {
+        log::error("block_store")<<"block too large: "<<data.size();
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(lock_);
+    uint64_t count = count_.load(std::memory_order_relaxed);
+    if (index_fd_ < 0 || !reserve_index(count + 1)) {
+        return false;
+    }
+    if (write_offset_ + data.size() > SEGMENT_SIZE) {
+        // 写满的段不再变化，换段前落盘一次
+        ::fdatasync(segments_.back().fd);
+        if (!open_segment(segments_.size())) {
+            return false;
+        }
+        write_offset_ = 0;
+    }
+
+    // 先写数据，再写索引记录，最后发布记录数；崩溃时最多丢失尾部未计数的区块，读者也只能看到完整记录
+    record r{uint32_t(segments_.size() - 1), uint32_t(data.size()), write_offset_};
+    if (!write_all(segments_.back().fd, data.data(), data.size(), r.offset)) {
+        log::error("block_store")<<"write block failed: "<<strerror(errno);
+        return false;
+    }
+    put_record(count, r);
+    set_count(count + 1);
+    write_offset_ += data.size();
+
+    seq = count + 1;
+    if (mode_ != durability::os) {
+        pending_.push_back(clock_t::now());
+    }
+    if (mode_ == durability::every_block) {
+        flush_cond_.notify_one();
+    }
+    return true;
+}
+
+void block_store::wait_durable(uint64_t seq) {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (mode_ != durability::every_block) {
+        return;
+    }
+    durable_cond_.wait(lock, [this, seq] { return durable_ >= seq || stop_; });
+}
+
+void block_store::set_durability(durability mode, uint64_t interval_ms) {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        mode_ = mode;
+        interval_ms_ = std::max<uint64_t>(interval_ms, 1);
+    }
+    flush_cond_.notify_all();
+}
+
+durability block_store::get_durability() const {
+    std::unique_lock<std::mutex> lock(lock_);
+    return mode_;
+}
+
+commit_stats block_store::stats() const {
+    std::unique_lock<std::mutex> lock(lock_);
+    return stats_;
+}
 
+void block_store::flusher() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stop_) {
+        // 上一批fsync期间到达的区块直接进入下一批
+        if (mode_ == durability::every_block && count_ > durable_) {
+            sync_batch(lock);
+            continue;
+        }
+        if (mode_ == durability::interval) {
+            flush_cond_.wait_for(lock, std::chrono::milliseconds(interval_ms_));
+            if (count_ > durable_ && mode_ != durability::os) {
+                sync_batch(lock);
+            }
+        } else {
+            flush_cond_.wait(lock);
+        }
+    }
+    if (count_ > durable_) {
+        sync_batch(lock);
+    }
+}
+
+bool block_store::sync_batch(std::unique_lock<std::mutex>& lock) {
+    // 先段文件后索引: 已落盘的索引记录一定指向已落盘的数据
+    // 此前的段在换段时已落盘，只需同步当前段；索引的映射页也由fdatasync写回
+    uint64_t target = count_;
+    int segment_fd = segments_.back().fd;
+    int index_fd = index_fd_;
+    lock.unlock();
+    bool ok = ::fdatasync(segment_fd) == 0;
+    ok = ::fdatasync(index_fd) == 0 && ok;
+    auto&& now = clock_t::now();
+    lock.lock();
+
+    if (!ok) {
+        log::error("block_store")<<"fsync failed: "<<strerror(errno);
+    }
+    if (target > durable_) {
+        uint64_t batch = target - durable_;
+        stats_.commits++;
+        stats_.blocks += batch;
+        stats_.max_batch = std::max(stats_.max_batch, batch);
+        for (uint64_t i = 0; i < batch && !pending_.empty(); ++i) {
+            uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now - pending_.front()).count();
+            stats_.total_latency_us += us;
+            stats_.max_latency_us = std::max(stats_.max_latency_us, us);
+            pending_.pop_front();
+        }
+        durable_ = target;
+    }
+    durable_cond_.notify_all();
+    return ok;
+}
+
+bool block_store::read(uint64_t height, block_view& view) const {
+    if (height >= count_.load(std::memory_order_acquire)) {
+        return false;
+    }
+    auto&& r = get_record(height);
+    view.data = segments_[r.segment].map + r.offset;
+    view.size = r.length;
+    return true;
+}
+
+bool block_store::get(uint64_t height, block& out) const {
+    block_view view;
+    if (!read(height, view)) {
+        return false;
+    }
+    return view.decode(out);
+}
+
+uint64_t block_store::count() const {
+    return count_.load(std::memory_order_acquire);
+}
+
+bool block_store::flush() {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (index_fd_ < 0) {
+        return false;
+    }
+    return sync_batch(lock);
+}
+
+Json::Value commit_stats::to_json() const {
+    Json::Value root;
+    root["commits"] = commits;
+    root["blocks"] = blocks;
+    root["max_batch"] = max_batch;
+    root["avg_batch"] = commits ? double(blocks) / commits : 0.0;
+    root["avg_latency_us"] = blocks ? double(total_latency_us) / blocks : 0.0;
+    root["max_latency_us"] = max_latency_us;
+    return root;
+}
+
+// ---------------------------- chain_database ----------------------------
+
+static const uint32_t HASH_FILE_MAGIC = 0x48424354;    // "TCBH"
+static const uint32_t HASH_FILE_VERSION = 1;
+static const size_t HASH_FILE_HEADER = 8;
+
+chain_database::~chain_database() {
+    if (hash_fd_ >= 0) {
+        ::close(hash_fd_);
+    }
+}
+
+bool chain_database::open_hash_file(const std::string& path, uint64_t count, uint64_t& covered) {
+    covered = 0;
+    hash_fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (hash_fd_ < 0 || ::fstat(hash_fd_, &st) != 0) {
+        log::error("chain_database")<<"open "<<path<<" failed: "<<strerror(errno);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void* map = size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, hash_fd_, 0) : MAP_FAILED;
+    if (map != MAP_FAILED) {
+        auto in = static_cast<const uint8_t*>(map);
+        if (size >= HASH_FILE_HEADER && get_u32(in) == HASH_FILE_MAGIC && get_u32(in + 4) == HASH_FILE_VERSION) {
+            uint64_t total = std::min<uint64_t>((size - HASH_FILE_HEADER) / hash256::SIZE, count);
+            const uint8_t* records = in + HASH_FILE_HEADER;
+            while (covered < total && !hash256(records + covered * hash256::SIZE).is_null()) {
+                ++covered;
+            }
+            // 未落盘的文件与存储可能不一致，核对最后一条即可发现截断或错位
+            hash256 hash;
+            std::vector<hash256> tx_hashes;
+            block_view view;
+            if (covered > 0 && (!store_.read(covered - 1, view) || !block::scan(view.data, view.size, hash, tx_hashes)
+                        || hash != hash256(records + (covered - 1) * hash256::SIZE))) {
+                log::warning("chain_database")<<path<<": does not match block store, rebuilding";
+                covered = 0;
+            }
+            for (uint64_t h = 0; h < covered; ++h) {
+                hash_index_[hash256(records + h * hash256::SIZE)] = h;
+            }
+        } else {
+            log::warning("chain_database")<<path<<": bad header, rebuilding";
+        }
+        ::munmap(map, size);
+    }
+
+    uint8_t header[HASH_FILE_HEADER];
+    put_u32(header, HASH_FILE_MAGIC);
+    put_u32(header + 4, HASH_FILE_VERSION);
+    if (::ftruncate(hash_fd_, HASH_FILE_HEADER + covered * hash256::SIZE) != 0
+            || !write_all(hash_fd_, header, sizeof(header), 0)) {
+        log::error("chain_database")<<"truncate "<<path<<" failed: "<<strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+void chain_database::append_hash(const hash256& hash, uint64_t height) {
+    if (hash_fd_ < 0) {
+        return;
+    }
+    if (!write_all(hash_fd_, hash.data(), hash256::SIZE, HASH_FILE_HEADER + height * hash256::SIZE)) {
+        log::error("chain_database")<<"write blockhash.dat failed: "<<strerror(errno)<<", stop persisting";
+        ::close(hash_fd_);
+        hash_fd_ = -1;
+    }
+}
+
+bool chain_database::open(const std::string& dir) {
+    if (!store_.open(dir)) {
+        return false;
+    }
+    std::unique_lock<std::mutex> write_lock(write_lock_);
+    std::unique_lock<std::shared_timed_mutex> lock(index_lock_);
+    uint64_t count = store_.count();
+    // 两个索引都从文件载入，只有文件未覆盖的区块需要扫描并补写
+    uint64_t hash_covered, tx_covered;
+    hash_index_.reserve(count);
+    if (!open_hash_file(dir + "/blockhash.dat", count, hash_covered)
+            || !tx_index_.open(dir + "/txindex.dat", count, tx_covered)) {
+        return false;
+    }
+    // 直接在映射区上扫描哈希，不解码整个区块
+    hash256 hash;
+    std::vector<hash256> tx_hashes;
+    for (uint64_t h = std::min(hash_covered, tx_covered); h < count; ++h) {
+        block_view view;
+        if (!store_.read(h, view) || !block::scan(view.data, view.size, hash, tx_hashes)) {
+            log::error("chain_database")<<"corrupt block at height "<<h;
+            return false;
+        }
+        if (h >= hash_covered) {
+            hash_index_[hash] = h;
+            append_hash(hash, h);
+        }
+        if (h >= tx_covered) {
+            for (uint32_t i = 0; i < tx_hashes.size(); ++i) {
+                tx_index_.put(tx_hashes[i], tx_location{h, i});
+            }
+            tx_index_.append(tx_hashes, h);
+        }
+    }
+    log::info("chain_database")<<"loaded indexes of "<<count<<" blocks, scanned "
+        <<count - std::min(hash_covered, tx_covered);
+
+    block_ptr tip;
+    if (count > 0) {
+        auto last = std::make_shared<block>();
+        if (!store_.get(count - 1, *last)) {
+            return false;
+        }
+        tip = last;
+    }
+    publish(count, tip);
+    return true;
+}
+
+void chain_database::publish(uint64_t count, const block_ptr& tip) {
+    auto next = std::make_shared<chain_view>();
+    next->version = view()->version + 1;
+    next->count = count;
+    next->tip = tip;
+    std::atomic_store(&view_, chain_view_ptr(next));
+}
+
+void chain_database::index_block(const hash256& hash, const std::vector<hash256>& tx_hashes, uint64_t height) {
+    hash_index_[hash] = height;
+    for (uint32_t i = 0; i < tx_hashes.size(); ++i) {
+        tx_index_.put(tx_hashes[i], tx_location{height, i});
+    }
+}
+
+void chain_database::print() {
+    uint64_t count = store_.count();
+    for (uint64_t h = 0; h < count; ++h) {
+        block_ptr b;
+        if (get_block(h, b)) {
+            log::info("block")<<b->to_string();
+        }
+    }
+}
+
+bool chain_database::push(const block& item, uint64_t& seq) {
+    std::unique_lock<std::mutex> write_lock(write_lock_);
+    uint64_t height = store_.count();
+    if (!store_.append(item, seq)) {
+        return false;
+    }
+    auto&& tx_hashes = item.tx_hashes();
+    {
+        std::unique_lock<std::shared_timed_mutex> lock(index_lock_);
+        index_block(item.hash(), tx_hashes, height);
+    }
+    // 索引文件只由写者追加，不占读写锁
+    append_hash(item.hash(), height);
+    tx_index_.append(tx_hashes, height);
+    // 新链头在索引就绪后才对读者可见
+    publish(height + 1, std::make_shared<const block>(item));
+    return true;
+}
+
+bool chain_database::get_block (const hash256 block_hash, block_ptr& b) {
+    uint64_t height;
+    if (!get_height(block_hash, height)) {
+        return false;
+    }
+    return get_block(height, b);
+}
+
+bool chain_database::get_block (uint64_t height, block_ptr& b) {
+    auto&& current = view();
+    if (current->tip && height + 1 == current->count) {
+        b = current->tip;
+        return true;
+    }
+    if (cache_.get(height, b)) {
+        return true;
+    }
+    block_view view;
+    auto decoded = std::make_shared<block>();
+    if (!store_.read(height, view) || !view.decode(*decoded)) {
+        return false;
+    }
+    b = decoded;
+    cache_.put(height, b, view.size);
+    return true;
+}
+
+bool chain_database::get_height (const hash256 block_hash, uint64_t& height) {
+    std::shared_lock<std::shared_timed_mutex> lock(index_lock_);
+    auto iter = hash_index_.find(block_hash);
+    if (iter == hash_index_.end()) {
+        return false;
+    }
+    height = iter->second;
+    return true;
+}
+
+bool chain_database::get_tx_block (const hash256 tx_hash, block_ptr& b, size_t& pos) {
+    tx_location location;
+    {
+        std::shared_lock<std::shared_timed_mutex> lock(index_lock_);
+        if (!tx_index_.get(tx_hash, location)) {
+            return false;
+        }
+    }
+    pos = location.position;
+    return get_block(location.height, b);
+}
+
+bool chain_database::get_tx (const hash256 tx_hash, tx& t) {
+    block_ptr b;
+    size_t pos;
+    if (!get_tx_block(tx_hash, b, pos)) {
+        return false;
+    }
+    t = b->tx_at(pos);
+    return true;
+}
+
+
+} //tinychain
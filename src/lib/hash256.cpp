@@ -0,0 +1,35 @@
+#include <tinychain/hash256.hpp>
+
+namespace tinychain {
+
+bool hash256::from_hex(const std::string& hex, hash256& out)
+{
+    bytes_t bytes;
+    if (!tinychain::from_hex(hex, bytes.data(), SIZE)) {
+        return false;
+    }
+    out.data_ = bytes;
+    return true;
+}
+
+std::string hash256::to_hex() const
+{
+    return tinychain::to_hex(data_.data(), SIZE);
+}
+
+hash256 sha256_hash(const uint8_t* data, size_t len)
+{
+    hash256 out;
+    SHA256 ctx;
+    ctx.init();
+    ctx.update(data, len);
+    ctx.final(out.data());
+    return out;
+}
+
+hash256 sha256_hash(const std::string& input)
+{
+    return sha256_hash(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+}
+
+} // namespace tinychain
@@ -0,0 +1,229 @@
+#include <cstring>
+#include <tinychain/hex.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TC_HEX_X86 1
+#endif
+
+namespace tinychain {
+
+namespace {
+
+typedef void (*encode_fn)(const uint8_t* in, size_t len, char* out);
+typedef bool (*decode_fn)(const char* in, size_t len, uint8_t* out);
+
+const char hex_digits[] = "0123456789abcdef";
+
+// 每个字节对应的两个字符
+struct encode_table
+{
+    char pairs[256][2];
+    encode_table() {
+        for (int i = 0; i < 256; i++) {
+            pairs[i][0] = hex_digits[i >> 4];
+            pairs[i][1] = hex_digits[i & 0x0f];
+        }
+    }
+};
+
+// 每个字符对应的半字节，非法字符为-1
+struct decode_table
+{
+    int8_t nibbles[256];
+    decode_table() {
+        memset(nibbles, -1, sizeof(nibbles));
+        for (int i = 0; i < 10; i++) {
+            nibbles['0' + i] = int8_t(i);
+        }
+        for (int i = 0; i < 6; i++) {
+            nibbles['a' + i] = int8_t(10 + i);
+            nibbles['A' + i] = int8_t(10 + i);
+        }
+    }
+};
+
+const encode_table encode_lut;
+const decode_table decode_lut;
+
+void encode_scalar(const uint8_t* in, size_t len, char* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        memcpy(out + 2 * i, encode_lut.pairs[in[i]], 2);
+    }
+}
+
+bool decode_scalar(const char* in, size_t len, uint8_t* out)
+{
+    for (size_t i = 0; i < len; i++) {
+        int8_t hi = decode_lut.nibbles[uint8_t(in[2 * i])];
+        int8_t lo = decode_lut.nibbles[uint8_t(in[2 * i + 1])];
+        if ((hi | lo) < 0) {
+            return false;
+        }
+        out[i] = uint8_t((hi << 4) | lo);
+    }
+    return true;
+}
+
+#ifdef TC_HEX_X86
+
+// 每16字节: 拆成高低半字节，pshufb查"0123456789abcdef"，再交错成32个字符
+__attribute__((target("ssse3")))
+void encode_ssse3(const uint8_t* in, size_t len, char* out)
+{
+    const __m128i lut = _mm_loadu_si128((const __m128i*) hex_digits);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (in + i));
+        __m128i hi = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+        _mm_storeu_si128((__m128i*) (out + 2 * i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*) (out + 2 * i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    encode_scalar(in + i, len - i, out + 2 * i);
+}
+
+__attribute__((target("avx2")))
+void encode_avx2(const uint8_t* in, size_t len, char* out)
+{
+    const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) hex_digits));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (in + i));
+        __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, mask));
+        // unpack按128位分道交错，最后按道重排
+        __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i*) (out + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*) (out + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    encode_ssse3(in + i, len - i, out + 2 * i);
+}
+
+// 字符按有符号字节判断: '0'~'9' 或 (c|0x20) 在 'a'~'f'，其余(含>=0x80)均非法
+#define HEX_DECODE_NIBBLES(PREFIX, SUFFIX, chars, values, valid)                          \
+{                                                                                         \
+    auto digit = PREFIX##_sub_epi8(chars, PREFIX##_set1_epi8('0'));                       \
+    auto alpha = PREFIX##_sub_epi8(PREFIX##_or_##SUFFIX(chars, PREFIX##_set1_epi8(0x20)), \
+                                   PREFIX##_set1_epi8('a'));                              \
+    auto is_digit = PREFIX##_and_##SUFFIX(PREFIX##_cmpgt_epi8(digit, PREFIX##_set1_epi8(-1)), \
+                                          PREFIX##_cmpgt_epi8(PREFIX##_set1_epi8(10), digit)); \
+    auto is_alpha = PREFIX##_and_##SUFFIX(PREFIX##_cmpgt_epi8(alpha, PREFIX##_set1_epi8(-1)), \
+                                          PREFIX##_cmpgt_epi8(PREFIX##_set1_epi8(6), alpha)); \
+    valid = PREFIX##_or_##SUFFIX(is_digit, is_alpha);                                     \
+    values = PREFIX##_or_##SUFFIX(PREFIX##_and_##SUFFIX(is_digit, digit),                 \
+        PREFIX##_and_##SUFFIX(is_alpha, PREFIX##_add_epi8(alpha, PREFIX##_set1_epi8(10)))); \
+}
+
+// 每32个字符: 校验并转成半字节，maddubs把相邻两个半字节合成一个字节
+__attribute__((target("ssse3")))
+bool decode_ssse3(const char* in, size_t len, uint8_t* out)
+{
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chars0 = _mm_loadu_si128((const __m128i*) (in + 2 * i));
+        __m128i chars1 = _mm_loadu_si128((const __m128i*) (in + 2 * i + 16));
+        __m128i values0, values1, valid0, valid1;
+        HEX_DECODE_NIBBLES(_mm, si128, chars0, values0, valid0)
+        HEX_DECODE_NIBBLES(_mm, si128, chars1, values1, valid1)
+        if (_mm_movemask_epi8(_mm_and_si128(valid0, valid1)) != 0xffff) {
+            return false;
+        }
+        __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(values0, weights),
+                                         _mm_maddubs_epi16(values1, weights));
+        _mm_storeu_si128((__m128i*) (out + i), bytes);
+    }
+    return decode_scalar(in + 2 * i, len - i, out + i);
+}
+
+__attribute__((target("avx2")))
+bool decode_avx2(const char* in, size_t len, uint8_t* out)
+{
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i chars0 = _mm256_loadu_si256((const __m256i*) (in + 2 * i));
+        __m256i chars1 = _mm256_loadu_si256((const __m256i*) (in + 2 * i + 32));
+        __m256i values0, values1, valid0, valid1;
+        HEX_DECODE_NIBBLES(_mm256, si256, chars0, values0, valid0)
+        HEX_DECODE_NIBBLES(_mm256, si256, chars1, values1, valid1)
+        if (_mm256_movemask_epi8(_mm256_and_si256(valid0, valid1)) != -1) {
+            return false;
+        }
+        // packus按128位分道交错，重排成 [0,2,1,3]
+        __m256i bytes = _mm256_packus_epi16(_mm256_maddubs_epi16(values0, weights),
+                                            _mm256_maddubs_epi16(values1, weights));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_permute4x64_epi64(bytes, 0xD8));
+    }
+    return decode_ssse3(in + 2 * i, len - i, out + i);
+}
+
+#undef HEX_DECODE_NIBBLES
+
+#endif // TC_HEX_X86
+
+struct codec
+{
+    encode_fn encode;
+    decode_fn decode;
+    const char* name;
+};
+
+codec select_codec()
+{
+#ifdef TC_HEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {encode_avx2, decode_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return {encode_ssse3, decode_ssse3, "ssse3"};
+    }
+#endif
+    return {encode_scalar, decode_scalar, "scalar"};
+}
+
+const codec& selected()
+{
+    static const codec c = select_codec();
+    return c;
+}
+
+} // namespace
+
+void hex_encode(const uint8_t* in, size_t len, char* out)
+{
+    selected().encode(in, len, out);
+}
+
+std::string to_hex(const unsigned char* data, size_t len)
+{
+    std::string out(2 * len, 0);
+    hex_encode(data, len, &out[0]);
+    return out;
+}
+
+bool hex_decode(const char* in, size_t len, uint8_t* out)
+{
+    return selected().decode(in, len, out);
+}
+
+bool from_hex(const std::string& hex, uint8_t* out, size_t len)
+{
+    if (hex.size() != 2 * len) {
+        return false;
+    }
+    return hex_decode(hex.data(), len, out);
+}
+
+const char* hex_backend()
+{
+    return selected().name;
+}
+
+} // namespace tinychain
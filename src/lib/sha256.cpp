@@ -1,5 +1,6 @@
 #include <cstring>
 #include <fstream>
+#include <vector>
 #include <tinychain/sha256.hpp>
 
 namespace tinychain {
@@ -22,24 +23,21 @@ const unsigned int SHA256::sha256_k[64] = //UL = uint32
              0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
              0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
  
-void SHA256::transform(const unsigned char *message, unsigned int block_nb)
+void SHA256::compress_generic(uint32_t *state, const unsigned char *data, size_t blocks)
 {
-    uint32 w[64];
-    uint32 wv[8];
-    uint32 t1, t2;
-    const unsigned char *sub_block;
-    int i;
-    int j;
-    for (i = 0; i < (int) block_nb; i++) {
-        sub_block = message + (i << 6);
+    for (; blocks > 0; blocks--, data += SHA224_256_BLOCK_SIZE) {
+        uint32 w[64];
+        uint32 wv[8];
+        uint32 t1, t2;
+        int j;
         for (j = 0; j < 16; j++) {
-            SHA2_PACK32(&sub_block[j << 2], &w[j]);
+            SHA2_PACK32(&data[j << 2], &w[j]);
         }
         for (j = 16; j < 64; j++) {
             w[j] =  SHA256_F4(w[j -  2]) + w[j -  7] + SHA256_F3(w[j - 15]) + w[j - 16];
         }
         for (j = 0; j < 8; j++) {
-            wv[j] = m_h[j];
+            wv[j] = state[j];
         }
         for (j = 0; j < 64; j++) {
             t1 = wv[7] + SHA256_F2(wv[4]) + SHA2_CH(wv[4], wv[5], wv[6])
@@ -55,21 +53,69 @@ void SHA256::transform(const unsigned char *message, unsigned int block_nb)
             wv[0] = t1 + t2;
         }
         for (j = 0; j < 8; j++) {
-            m_h[j] += wv[j];
+            state[j] += wv[j];
         }
     }
 }
+
+static SHA256::compress_blocks_fn detect_backend()
+{
+    if (SHA256::shani_supported() && sha256_self_test_backend(SHA256::compress_shani)) {
+        return SHA256::compress_shani;
+    }
+    return SHA256::compress_generic;
+}
+
+SHA256::compress_blocks_fn SHA256::select_backend()
+{
+    // CPUID检测与自检只在首次调用时做一次
+    static const compress_blocks_fn backend = detect_backend();
+    return backend;
+}
+
+void SHA256::compress_blocks(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+    static const compress_blocks_fn backend = select_backend();
+    backend(state, data, blocks);
+}
+
+void SHA256::compress(uint32_t *state, const unsigned char *block)
+{
+    compress_blocks(state, block, 1);
+}
+
+const char* SHA256::backend()
+{
+    return (select_backend() == compress_shani) ? "sha-ni" : "scalar";
+}
+
+void SHA256::initial_state(uint32_t *state)
+{
+    state[0] = 0x6a09e667;
+    state[1] = 0xbb67ae85;
+    state[2] = 0x3c6ef372;
+    state[3] = 0xa54ff53a;
+    state[4] = 0x510e527f;
+    state[5] = 0x9b05688c;
+    state[6] = 0x1f83d9ab;
+    state[7] = 0x5be0cd19;
+}
+
+void SHA256::state_to_digest(const uint32_t *state, unsigned char *digest)
+{
+    for (int i = 0 ; i < 8; i++) {
+        SHA2_UNPACK32(state[i], &digest[i << 2]);
+    }
+}
+
+void SHA256::transform(const unsigned char *message, unsigned int block_nb)
+{
+    compress_blocks(m_h, message, block_nb);
+}
  
 void SHA256::init()
 {
-    m_h[0] = 0x6a09e667;
-    m_h[1] = 0xbb67ae85;
-    m_h[2] = 0x3c6ef372;
-    m_h[3] = 0xa54ff53a;
-    m_h[4] = 0x510e527f;
-    m_h[5] = 0x9b05688c;
-    m_h[6] = 0x1f83d9ab;
-    m_h[7] = 0x5be0cd19;
+    initial_state(m_h);
     m_len = 0;
     m_tot_len = 0;
 }
@@ -102,7 +148,6 @@ void SHA256::final(unsigned char *digest)
     unsigned int block_nb;
     unsigned int pm_len;
     unsigned int len_b;
-    int i;
     block_nb = (1 + ((SHA224_256_BLOCK_SIZE - 9)
                      < (m_len % SHA224_256_BLOCK_SIZE)));
     len_b = (m_tot_len + m_len) << 3;
@@ -111,9 +156,7 @@ void SHA256::final(unsigned char *digest)
     m_block[m_len] = 0x80;
     SHA2_UNPACK32(len_b, m_block + pm_len - 4);
     transform(m_block, block_nb);
-    for (i = 0 ; i < 8; i++) {
-        SHA2_UNPACK32(m_h[i], &digest[i << 2]);
-    }
+    state_to_digest(m_h, digest);
 }
  
 std::string sha256(const std::string& input)
@@ -126,11 +169,111 @@ std::string sha256(const std::string& input)
     ctx.update( (unsigned char*)input.c_str(), input.length());
     ctx.final(digest);
  
-    char buf[2*SHA256::DIGEST_SIZE+1];
-    buf[2*SHA256::DIGEST_SIZE] = 0;
-    for (uint32_t i = 0; i < SHA256::DIGEST_SIZE; i++)
-        sprintf(buf+i*2, "%02x", digest[i]);
-    return std::string(buf);
+    return to_hex(digest, SHA256::DIGEST_SIZE);
+}
+
+void sha256_pad(const std::string& msg, std::string& out)
+{
+    uint64_t bits = uint64_t(msg.size()) << 3;
+    size_t total = (msg.size() + 9 + SHA256::BLOCK_SIZE - 1) / SHA256::BLOCK_SIZE * SHA256::BLOCK_SIZE;
+    out.assign(total, 0);
+    memcpy(&out[0], msg.data(), msg.size());
+    out[msg.size()] = char(0x80);
+    for (int i = 0; i < 8; i++) {
+        out[total - 1 - i] = char(bits >> (8 * i));
+    }
+}
+
+// ---------------------------- 自检 ----------------------------
+namespace {
+
+struct known_answer
+{
+    std::string message;
+    const char* digest;
+};
+
+const std::vector<known_answer>& known_answers()
+{
+    static const std::vector<known_answer> kat = {
+        {"", "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"},
+        {"abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"},
+        {"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"},
+        {"abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmno"
+            "ijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+            "cf5b16a778af8380036ce59e7b0492370b249b11e8f07a51afac45037afee9d1"},
+        {std::string(1000000, 'a'), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"},
+    };
+    return kat;
+}
+
+// 用确定性的伪随机消息覆盖各种填充边界(0~300字节)
+std::vector<std::string> boundary_messages()
+{
+    std::vector<std::string> msgs;
+    uint32_t seed = 0x12345678;
+    for (size_t len = 0; len <= 300; len++) {
+        std::string msg(len, 0);
+        for (auto& c : msg) {
+            seed = seed * 1103515245 + 12345;
+            c = char(seed >> 16);
+        }
+        msgs.push_back(msg);
+    }
+    return msgs;
+}
+
+template <typename Fn>
+std::string digest_with(Fn compress_blocks, const std::string& msg)
+{
+    std::string padded;
+    sha256_pad(msg, padded);
+    uint32_t state[8];
+    unsigned char digest[SHA256::DIGEST_SIZE];
+    SHA256::initial_state(state);
+    compress_blocks(state, reinterpret_cast<const unsigned char*>(padded.data()),
+        padded.size() / SHA256::BLOCK_SIZE);
+    SHA256::state_to_digest(state, digest);
+    return to_hex(digest, SHA256::DIGEST_SIZE);
+}
+
+} // namespace
+
+bool sha256_self_test_backend(SHA256::compress_blocks_fn compress_blocks)
+{
+    for (auto& each : known_answers()) {
+        if (digest_with(compress_blocks, each.message) != each.digest) {
+            return false;
+        }
+    }
+    // 与标量实现逐位一致
+    for (auto& each : boundary_messages()) {
+        if (digest_with(compress_blocks, each) != digest_with(SHA256::compress_generic, each)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sha256_self_test()
+{
+    for (auto& each : known_answers()) {
+        if (sha256(each.message) != each.digest) {
+            return false;
+        }
+    }
+
+    auto&& msgs = boundary_messages();
+    std::vector<sha256_digest_t> digests(msgs.size());
+    sha256_many(msgs.data(), msgs.size(), digests.data());
+    for (size_t i = 0; i < msgs.size(); i++) {
+        if (to_hex(digests[i].data(), SHA256::DIGEST_SIZE)
+                != digest_with(SHA256::compress_generic, msgs[i])) {
+            return false;
+        }
+    }
+    return true;
 }
 
 } // namespace tinychain
@@ -0,0 +1,94 @@
+#include <tinychain/sha256.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TC_SHA256_X86 1
+#endif
+
+namespace tinychain {
+
+#ifdef TC_SHA256_X86
+
+bool SHA256::shani_supported()
+{
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("sse4.1") || !__builtin_cpu_supports("ssse3")) {
+        return false;
+    }
+    // CPUID.(EAX=7,ECX=0):EBX[bit 29] = SHA extensions
+    unsigned int eax, ebx, ecx, edx;
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(0), "c"(0));
+    if (eax < 7) {
+        return false;
+    }
+    __asm__ __volatile__("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(7), "c"(0));
+    return (ebx >> 29) & 1;
+}
+
+// 基于Intel SHA扩展指令: 状态以ABEF/CDGH两个寄存器保存，
+// 每组4轮用两次sha256rnds2，消息扩展用sha256msg1/sha256msg2
+__attribute__((target("sha,sse4.1,ssse3")))
+void SHA256::compress_shani(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+    const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i tmp = _mm_loadu_si128((const __m128i*) &state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i*) &state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);            // CDAB
+    state1 = _mm_shuffle_epi32(state1, 0x1B);      // EFGH
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8); // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);   // CDGH
+
+    __m128i msgs[4];
+    for (; blocks > 0; blocks--, data += 64) {
+        __m128i abef_save = state0;
+        __m128i cdgh_save = state1;
+
+        for (int i = 0; i < 16; i++) {
+            if (i < 4) {
+                msgs[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) (data + 16 * i)), mask);
+            }
+            __m128i& cur = msgs[i & 3];
+
+            __m128i msg = _mm_add_epi32(cur, _mm_loadu_si128((const __m128i*) &sha256_k[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            if (i >= 3 && i <= 14) {
+                __m128i& next = msgs[(i + 1) & 3];
+                next = _mm_add_epi32(next, _mm_alignr_epi8(cur, msgs[(i + 3) & 3], 4));
+                next = _mm_sha256msg2_epu32(next, cur);
+            }
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+            if (i >= 1 && i <= 12) {
+                msgs[(i + 3) & 3] = _mm_sha256msg1_epu32(msgs[(i + 3) & 3], cur);
+            }
+        }
+
+        state0 = _mm_add_epi32(state0, abef_save);
+        state1 = _mm_add_epi32(state1, cdgh_save);
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);         // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);      // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);   // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);      // HGFE
+
+    _mm_storeu_si128((__m128i*) &state[0], state0);
+    _mm_storeu_si128((__m128i*) &state[4], state1);
+}
+
+#else
+
+bool SHA256::shani_supported()
+{
+    return false;
+}
+
+void SHA256::compress_shani(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+    compress_generic(state, data, blocks);
+}
+
+#endif // TC_SHA256_X86
+
+} // namespace tinychain
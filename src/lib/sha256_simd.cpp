@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <vector>
+#include <tinychain/sha256.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TC_SHA256_X86 1
+#endif
+
+namespace tinychain {
+
+namespace {
+
+typedef void (*compress_lanes_fn)(uint32_t *states, const unsigned char *const *blocks);
+
+struct lanes_kernel
+{
+    size_t lanes;
+    compress_lanes_fn fn;
+    const char* name;
+};
+
+// 各路消息字按大端读入，并转置成 [字][路]
+template <size_t LANES>
+void load_lanes(uint32_t (*w)[LANES], const unsigned char *const *blocks)
+{
+    for (size_t l = 0; l < LANES; l++) {
+        for (size_t j = 0; j < 16; j++) {
+            const unsigned char *p = &blocks[l][j << 2];
+            w[j][l] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16)
+                    | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+    }
+}
+
+template <size_t LANES>
+void load_states(uint32_t (*st)[LANES], const uint32_t *states)
+{
+    for (size_t l = 0; l < LANES; l++) {
+        for (size_t i = 0; i < 8; i++) {
+            st[i][l] = states[l * 8 + i];
+        }
+    }
+}
+
+template <size_t LANES>
+void store_states(uint32_t *states, uint32_t (*st)[LANES])
+{
+    for (size_t l = 0; l < LANES; l++) {
+        for (size_t i = 0; i < 8; i++) {
+            states[l * 8 + i] = st[i][l];
+        }
+    }
+}
+
+#ifdef TC_SHA256_X86
+
+// 内核主体，向量运算由各指令集的 MB_* 宏提供
+#define SHA256_MB_COMPRESS(VEC, LANES)                                        \
+{                                                                             \
+    alignas(64) uint32_t in[16][LANES];                                       \
+    alignas(64) uint32_t st[8][LANES];                                        \
+    load_lanes<LANES>(in, blocks);                                            \
+    load_states<LANES>(st, states);                                           \
+    VEC w[64];                                                                \
+    for (int j = 0; j < 16; j++) {                                            \
+        w[j] = MB_LOAD(in[j]);                                                \
+    }                                                                         \
+    for (int j = 16; j < 64; j++) {                                           \
+        w[j] = MB_ADD(MB_ADD(MB_S1(w[j - 2]), w[j - 7]),                      \
+                      MB_ADD(MB_S0(w[j - 15]), w[j - 16]));                   \
+    }                                                                         \
+    VEC a = MB_LOAD(st[0]), b = MB_LOAD(st[1]);                               \
+    VEC c = MB_LOAD(st[2]), d = MB_LOAD(st[3]);                               \
+    VEC e = MB_LOAD(st[4]), f = MB_LOAD(st[5]);                               \
+    VEC g = MB_LOAD(st[6]), h = MB_LOAD(st[7]);                               \
+    for (int j = 0; j < 64; j++) {                                            \
+        VEC t1 = MB_ADD(MB_ADD(MB_ADD(h, MB_E1(e)), MB_CH(e, f, g)),          \
+                        MB_ADD(MB_SET1(SHA256::sha256_k[j]), w[j]));          \
+        VEC t2 = MB_ADD(MB_E0(a), MB_MAJ(a, b, c));                           \
+        h = g; g = f; f = e; e = MB_ADD(d, t1);                               \
+        d = c; c = b; b = a; a = MB_ADD(t1, t2);                              \
+    }                                                                         \
+    MB_STORE(st[0], MB_ADD(MB_LOAD(st[0]), a));                               \
+    MB_STORE(st[1], MB_ADD(MB_LOAD(st[1]), b));                               \
+    MB_STORE(st[2], MB_ADD(MB_LOAD(st[2]), c));                               \
+    MB_STORE(st[3], MB_ADD(MB_LOAD(st[3]), d));                               \
+    MB_STORE(st[4], MB_ADD(MB_LOAD(st[4]), e));                               \
+    MB_STORE(st[5], MB_ADD(MB_LOAD(st[5]), f));                               \
+    MB_STORE(st[6], MB_ADD(MB_LOAD(st[6]), g));                               \
+    MB_STORE(st[7], MB_ADD(MB_LOAD(st[7]), h));                               \
+    store_states<LANES>(states, st);                                          \
+}
+
+#define MB_XOR3(x, y, z)  MB_XOR(MB_XOR(x, y), z)
+#define MB_CH(x, y, z)    MB_XOR(MB_AND(x, y), MB_ANDNOT(x, z))
+#define MB_MAJ(x, y, z)   MB_OR(MB_AND(x, y), MB_AND(z, MB_OR(x, y)))
+#define MB_E0(x) MB_XOR3(MB_ROTR(x,  2), MB_ROTR(x, 13), MB_ROTR(x, 22))
+#define MB_E1(x) MB_XOR3(MB_ROTR(x,  6), MB_ROTR(x, 11), MB_ROTR(x, 25))
+#define MB_S0(x) MB_XOR3(MB_ROTR(x,  7), MB_ROTR(x, 18), MB_SHR(x,  3))
+#define MB_S1(x) MB_XOR3(MB_ROTR(x, 17), MB_ROTR(x, 19), MB_SHR(x, 10))
+
+// ---------------------------- sse4.1, 4路 ----------------------------
+#define MB_LOAD(p)        _mm_loadu_si128((const __m128i*)(p))
+#define MB_STORE(p, x)    _mm_storeu_si128((__m128i*)(p), x)
+#define MB_SET1(x)        _mm_set1_epi32((int)(x))
+#define MB_ADD(x, y)      _mm_add_epi32(x, y)
+#define MB_XOR(x, y)      _mm_xor_si128(x, y)
+#define MB_AND(x, y)      _mm_and_si128(x, y)
+#define MB_ANDNOT(x, y)   _mm_andnot_si128(x, y)
+#define MB_OR(x, y)       _mm_or_si128(x, y)
+#define MB_SHR(x, n)      _mm_srli_epi32(x, n)
+#define MB_ROTR(x, n)     _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("sse4.1")))
+void compress_x4(uint32_t *states, const unsigned char *const *blocks)
+SHA256_MB_COMPRESS(__m128i, 4)
+
+#undef MB_LOAD
+#undef MB_STORE
+#undef MB_SET1
+#undef MB_ADD
+#undef MB_XOR
+#undef MB_AND
+#undef MB_ANDNOT
+#undef MB_OR
+#undef MB_SHR
+#undef MB_ROTR
+
+// ---------------------------- avx2, 8路 ----------------------------
+#define MB_LOAD(p)        _mm256_loadu_si256((const __m256i*)(p))
+#define MB_STORE(p, x)    _mm256_storeu_si256((__m256i*)(p), x)
+#define MB_SET1(x)        _mm256_set1_epi32((int)(x))
+#define MB_ADD(x, y)      _mm256_add_epi32(x, y)
+#define MB_XOR(x, y)      _mm256_xor_si256(x, y)
+#define MB_AND(x, y)      _mm256_and_si256(x, y)
+#define MB_ANDNOT(x, y)   _mm256_andnot_si256(x, y)
+#define MB_OR(x, y)       _mm256_or_si256(x, y)
+#define MB_SHR(x, n)      _mm256_srli_epi32(x, n)
+#define MB_ROTR(x, n)     _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2")))
+void compress_x8(uint32_t *states, const unsigned char *const *blocks)
+SHA256_MB_COMPRESS(__m256i, 8)
+
+#undef MB_LOAD
+#undef MB_STORE
+#undef MB_SET1
+#undef MB_ADD
+#undef MB_XOR
+#undef MB_AND
+#undef MB_ANDNOT
+#undef MB_OR
+#undef MB_SHR
+#undef MB_ROTR
+
+// ---------------------------- avx512f, 16路 ----------------------------
+// 有原生循环移位和三元逻辑指令
+#undef MB_XOR3
+#undef MB_CH
+#undef MB_MAJ
+#define MB_LOAD(p)        _mm512_loadu_si512((const void*)(p))
+#define MB_STORE(p, x)    _mm512_storeu_si512((void*)(p), x)
+#define MB_SET1(x)        _mm512_set1_epi32((int)(x))
+#define MB_ADD(x, y)      _mm512_add_epi32(x, y)
+#define MB_SHR(x, n)      _mm512_srli_epi32(x, n)
+#define MB_ROTR(x, n)     _mm512_ror_epi32(x, n)
+#define MB_XOR3(x, y, z)  _mm512_ternarylogic_epi32(x, y, z, 0x96)
+#define MB_CH(x, y, z)    _mm512_ternarylogic_epi32(x, y, z, 0xca)
+#define MB_MAJ(x, y, z)   _mm512_ternarylogic_epi32(x, y, z, 0xe8)
+
+// GCC 12的avx512头文件在优化编译时对_mm512_undefined_epi32误报未初始化
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+void compress_x16(uint32_t *states, const unsigned char *const *blocks)
+SHA256_MB_COMPRESS(__m512i, 16)
+#pragma GCC diagnostic pop
+
+#undef MB_LOAD
+#undef MB_STORE
+#undef MB_SET1
+#undef MB_ADD
+#undef MB_SHR
+#undef MB_ROTR
+#undef MB_XOR3
+#undef MB_CH
+#undef MB_MAJ
+#undef MB_E0
+#undef MB_E1
+#undef MB_S0
+#undef MB_S1
+#undef SHA256_MB_COMPRESS
+
+#endif // TC_SHA256_X86
+
+// 按CPU支持情况从宽到窄排列
+std::vector<lanes_kernel> select_kernels()
+{
+    std::vector<lanes_kernel> kernels;
+#ifdef TC_SHA256_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        kernels.push_back({16, compress_x16, "avx512f"});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({8, compress_x8, "avx2"});
+    }
+    // 有SHA-NI时单路硬件指令比4路sse更快，余数交给SHA256::compress
+    if (__builtin_cpu_supports("sse4.1") && strcmp(SHA256::backend(), "sha-ni") != 0) {
+        kernels.push_back({4, compress_x4, "sse4.1"});
+    }
+#endif
+    return kernels;
+}
+
+const std::vector<lanes_kernel>& kernels()
+{
+    static const std::vector<lanes_kernel> selected = select_kernels();
+    return selected;
+}
+
+} // namespace
+
+size_t sha256_lanes()
+{
+    return kernels().empty() ? 1 : kernels().front().lanes;
+}
+
+const char* sha256_backend()
+{
+    return kernels().empty() ? "scalar" : kernels().front().name;
+}
+
+void sha256_compress_many(uint32_t *states, const unsigned char *const *blocks, size_t n)
+{
+    size_t i = 0;
+    for (auto& each : kernels()) {
+        for (; n - i >= each.lanes; i += each.lanes) {
+            each.fn(states + 8 * i, blocks + i);
+        }
+    }
+    for (; i < n; i++) {
+        SHA256::compress(states + 8 * i, blocks[i]);
+    }
+}
+
+void sha256_many(const std::string *msgs, size_t n, sha256_digest_t *digests)
+{
+    std::vector<std::string> padded(n);
+    for (size_t i = 0; i < n; i++) {
+        sha256_pad(msgs[i], padded[i]);
+    }
+
+    // 块数相同的消息才能按路对齐，按块数分组
+    std::vector<size_t> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&padded](size_t x, size_t y) {
+            return padded[x].size() < padded[y].size();
+            });
+
+    std::vector<uint32_t> states(8 * n);
+    std::vector<const unsigned char*> blocks(n);
+    for (size_t i = 0; i < n; i++) {
+        SHA256::initial_state(&states[8 * i]);
+    }
+
+    for (size_t begin = 0, end = 0; begin < n; begin = end) {
+        size_t len = padded[order[begin]].size();
+        for (end = begin; end < n && padded[order[end]].size() == len; end++);
+
+        for (size_t off = 0; off < len; off += SHA256::BLOCK_SIZE) {
+            for (size_t i = begin; i < end; i++) {
+                blocks[i] = reinterpret_cast<const unsigned char*>(padded[order[i]].data()) + off;
+            }
+            sha256_compress_many(&states[8 * begin], &blocks[begin], end - begin);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        SHA256::state_to_digest(&states[8 * i], digests[order[i]].data());
+    }
+}
+
+} // namespace tinychain
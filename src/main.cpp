@@ -1,6 +1,7 @@
 #include <tinychain/tinychain.hpp>
 #include <tinychain/node.hpp>
 #include <metaverse/mgbubble.hpp>
+#include <limits>
 
 using namespace tinychain;
 using namespace mgbubble;
@@ -8,6 +9,77 @@ using namespace mgbubble;
 // global logger
 Logger logger;
 
+// 只接受十进制数字，溢出或超过max时返回false
+static bool parse_uint(const std::string& value, uint64_t max, uint64_t& out) {
+    if (value.empty() || value.size() > 20) {
+        return false;
+    }
+    uint64_t n = 0;
+    for (auto c : value) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        uint64_t digit = c - '0';
+        if (n > (max - digit) / 10) {
+            return false;
+        }
+        n = n * 10 + digit;
+    }
+    out = n;
+    return true;
+}
+
+// 落盘策略: -durability block|os|<毫秒>
+// UTXO快照间隔: -snapshot <区块数>
+// 区块缓存容量: -blockcache <MB>
+// 内存池上限: -maxmempool <MB>
+// 区块大小上限: -blockmaxsize <字节>
+static bool parse_options(int argc, char* argv[], chain_options& options) {
+    const uint64_t max_mb = std::numeric_limits<size_t>::max() >> 20;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg != "-snapshot" && arg != "-blockmaxsize" && arg != "-maxmempool"
+                && arg != "-blockcache" && arg != "-durability") {
+            continue;
+        }
+        if (i + 1 >= argc) {
+            log::error("main")<<"missing value for "<<arg;
+            return false;
+        }
+        std::string value = argv[++i];
+        uint64_t n = 0;
+        bool good = true;
+        if (arg == "-snapshot") {
+            good = parse_uint(value, std::numeric_limits<uint64_t>::max(), n);
+            options.snapshot_interval = n;
+        } else if (arg == "-blockmaxsize") {
+            // 至少要放得下区块头与coinbase
+            good = parse_uint(value, std::numeric_limits<uint64_t>::max(), n)
+                && n > block_assembler::BLOCK_OVERHEAD + block_assembler::COINBASE_RESERVE;
+            options.block_max_bytes = n;
+        } else if (arg == "-maxmempool") {
+            good = parse_uint(value, max_mb, n) && n > 0;
+            options.mempool_bytes = n << 20;
+        } else if (arg == "-blockcache") {
+            good = parse_uint(value, max_mb, n);
+            options.block_cache_bytes = n << 20;
+        } else if (value == "block") {
+            options.mode = durability::every_block;
+        } else if (value == "os") {
+            options.mode = durability::os;
+        } else {
+            good = parse_uint(value, std::numeric_limits<uint64_t>::max(), n) && n > 0;
+            options.mode = durability::interval;
+            options.flush_interval_ms = n;
+        }
+        if (!good) {
+            log::error("main")<<"bad value for "<<arg<<": "<<value;
+            return false;
+        }
+    }
+    return true;
+}
+
 int main(int argc, char* argv[])
 {
 
@@ -44,8 +116,19 @@ int main(int argc, char* argv[])
     blockchain1.print();
 #endif
 
+    // 参数有误时不打开存储，直接退出
+    chain_options options;
+    if (!parse_options(argc, argv, options)) {
+        return 1;
+    }
+
     // server setup
-    node my_node;
+    node my_node(options);
+    if (!my_node.ok()) {
+        log::error("main")<<"startup failed";
+        return 1;
+    }
+
     mgbubble::RestServ Server{"webroot", my_node};
     auto& conn = Server.bind("0.0.0.0:8000");
     mg_set_protocol_http_websocket(&conn);
@@ -0,0 +1,601 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+#include <tinychain/mempool.hpp>
+
+namespace tinychain
+{
+
+const uint64_t mempool::INCREMENTAL_FEE_RATE;
+const uint64_t mempool::FEE_RATE_HALFLIFE;
+const uint64_t mempool::MAX_ANCESTORS;
+const uint64_t mempool::MAX_DESCENDANTS;
+const uint64_t mempool::MAX_DESCENDANT_SIZE;
+const size_t mempool::JOURNAL_LIMIT;
+
+Json::Value mempool_stats::to_json() const {
+    Json::Value root;
+    root["count"] = count;
+    root["bytes"] = bytes;
+    root["usage"] = usage;
+    root["max_usage"] = max_usage;
+    root["min_fee_rate"] = min_fee_rate;
+    root["evictions"] = evictions;
+    root["rejected"] = rejected;
+    root["replacements"] = replacements;
+    return root;
+}
+
+// glibc malloc的实际占用: 8字节块头，16字节对齐，最小32字节
+static uint64_t malloc_usage(uint64_t n) {
+    if (n == 0) {
+        return 0;
+    }
+    return std::max<uint64_t>(32, (n + 8 + 15) & ~uint64_t(15));
+}
+
+uint64_t mempool::usage_of(const tx& t) {
+    // 哈希表节点(next指针+键值+缓存的哈希值) + 桶指针 + 两个优先级索引各一个红黑树节点(3指针+颜色+键)
+    uint64_t usage = malloc_usage(sizeof(void*) + sizeof(std::pair<const hash256, mempool_entry>) + sizeof(size_t))
+        + sizeof(void*)
+        + 2 * malloc_usage(4 * sizeof(void*) + sizeof(priority_key));
+    usage += malloc_usage(t.inputs().capacity() * sizeof(tx::input_t::value_type));
+    // 每个输入在花费索引中一个节点
+    usage += t.inputs().size() * (malloc_usage(sizeof(void*) + sizeof(std::pair<const outpoint, hash256>) + sizeof(size_t))
+            + sizeof(void*));
+    usage += malloc_usage(t.outputs().capacity() * sizeof(tx::output_t::value_type));
+    for (auto& each : t.outputs()) {
+        // 超出SSO的地址串单独分配
+        if (each.first.capacity() > 15) {
+            usage += malloc_usage(each.first.capacity() + 1);
+        }
+    }
+    return usage;
+}
+
+uint64_t mempool::min_fee_rate_locked(clock::time_point now) const {
+    if (rolling_min_fee_rate_ == 0) {
+        return 0;
+    }
+    double elapsed = std::chrono::duration<double>(now - last_bump_).count();
+    double rate = rolling_min_fee_rate_ / std::pow(2.0, elapsed / FEE_RATE_HALFLIFE);
+    // 回落到增量一半以下视为解除限制
+    if (rate < INCREMENTAL_FEE_RATE / 2.0) {
+        return 0;
+    }
+    return uint64_t(rate);
+}
+
+bool mempool::add(const tx& t, uint64_t fee, std::vector<tx>& removed) {
+    mempool_entry entry;
+    entry.value = t;
+    entry.fee = fee;
+    std::string encoded;
+    t.encode(encoded);
+    entry.size = encoded.size();
+    entry.usage = usage_of(entry.value);
+
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    if (by_id_.count(t.hash())) {
+        return false;
+    }
+    uint64_t min_rate = min_fee_rate_locked(clock::now());
+    if (entry.fee_rate() < min_rate) {
+        ++rejected_;
+        log::error("mempool")<<"reject tx "<<t.hash()<<": fee rate "<<entry.fee_rate()<<" below "<<min_rate;
+        return false;
+    }
+
+    // 祖先上限在替换之前检查，被拒绝的交易不能先逐出别人的交易
+    std::vector<hash256> ancestors;
+    ancestors_locked(t, ancestors);
+    if (ancestors.size() + 1 > MAX_ANCESTORS) {
+        ++rejected_;
+        log::error("mempool")<<"reject tx "<<t.hash()<<": too many unconfirmed ancestors";
+        return false;
+    }
+    for (auto& each : ancestors) {
+        if (!descendants_fit_locked(by_id_.at(each), entry.size)) {
+            ++rejected_;
+            log::error("mempool")<<"reject tx "<<t.hash()<<": too many unconfirmed descendants of "<<each;
+            return false;
+        }
+    }
+
+    // 冲突交易: 费率须高于每一笔，总手续费须覆盖被替换者(含其后代)并按自身大小再付一份增量
+    std::vector<hash256> conflicts;
+    txid_set replaced_set;
+    conflicts_locked(t, conflicts, replaced_set);
+    std::vector<hash256> replaced = conflicts;
+    if (!conflicts.empty()) {
+        uint64_t conflict_fees = 0;
+        for (auto& each : conflicts) {
+            auto& other = by_id_.at(each);
+            if (entry.fee_rate() <= other.fee_rate()) {
+                ++rejected_;
+                log::error("mempool")<<"reject tx "<<t.hash()<<": conflicts with "<<each;
+                return false;
+            }
+            descendants_locked(other.value, replaced, replaced_set);
+        }
+        for (auto& each : replaced) {
+            conflict_fees += by_id_.at(each).fee;
+        }
+        // 不能花费将被替换掉的交易的输出
+        for (auto& each : t.inputs()) {
+            if (replaced_set.count(each.first)) {
+                ++rejected_;
+                log::error("mempool")<<"reject tx "<<t.hash()<<": spends a tx it replaces";
+                return false;
+            }
+        }
+        if (fee < conflict_fees + INCREMENTAL_FEE_RATE * entry.size / 1000) {
+            ++rejected_;
+            log::error("mempool")<<"reject tx "<<t.hash()<<": fee "<<fee<<" too low to replace "<<replaced.size()<<" txs";
+            return false;
+        }
+    }
+
+    // 所有拒绝条件都在修改内存池之前判断完
+    if (!survives_trim_locked(entry, replaced, ancestors)) {
+        ++rejected_;
+        log::error("mempool")<<"reject tx "<<t.hash()<<": mempool full";
+        return false;
+    }
+
+    for (auto& each : conflicts) {
+        log::info("mempool")<<"replace tx "<<each<<" by "<<t.hash();
+        remove_tree_locked(each, removed);
+    }
+    replacements_ += replaced.size();
+
+    entry.ancestor_fee = fee;
+    entry.ancestor_size = entry.size;
+    entry.ancestor_count = ancestors.size() + 1;
+    for (auto& each : ancestors) {
+        auto& ancestor = by_id_.at(each);
+        entry.ancestor_fee += ancestor.fee;
+        entry.ancestor_size += ancestor.size;
+    }
+
+    entry.sequence = next_sequence_++;
+    usage_ += entry.usage;
+    bytes_ += entry.size;
+    record_locked(t.hash(), true);
+    by_priority_.insert(key_of(entry));
+    by_ancestor_score_.insert(ancestor_key_of(entry));
+    for (auto& each : t.inputs()) {
+        spenders_[outpoint{each.first, each.second}] = t.hash();
+    }
+    by_id_.emplace(t.hash(), std::move(entry));
+
+    // 预演已保证新交易不会被逐出
+    trim_locked(removed);
+    return true;
+}
+
+bool mempool::survives_trim_locked(const mempool_entry& entry, const std::vector<hash256>& replaced,
+        const std::vector<hash256>& ancestors) const {
+    uint64_t usage = usage_ + entry.usage;
+    txid_set gone(replaced.begin(), replaced.end());
+    txid_set ancestor_set(ancestors.begin(), ancestors.end());
+    for (auto& each : replaced) {
+        usage -= by_id_.at(each).usage;
+    }
+    // 与trim_locked同序: 从优先级最低的开始逐出整棵后代树，新交易序号最大，同费率时排在最后
+    priority_key self{entry.fee_rate(), next_sequence_, entry.value.hash()};
+    std::vector<hash256> tree;
+    for (auto iter = by_priority_.rbegin(); usage > max_usage_; ++iter) {
+        if (iter == by_priority_.rend() || *iter < self) {
+            return false;
+        }
+        if (!gone.insert(iter->tx_hash).second) {
+            continue;
+        }
+        // 已逐出的树不会再被收集，tree中只有这次新逐出的
+        tree.assign(1, iter->tx_hash);
+        descendants_locked(by_id_.at(iter->tx_hash).value, tree, gone);
+        for (auto& each : tree) {
+            // 祖先被逐出时新交易随之被逐出
+            if (ancestor_set.count(each)) {
+                return false;
+            }
+            usage -= by_id_.at(each).usage;
+        }
+    }
+    return true;
+}
+
+void mempool::conflicts_locked(const tx& t, std::vector<hash256>& out, txid_set& seen) const {
+    for (auto& each : t.inputs()) {
+        auto iter = spenders_.find(outpoint{each.first, each.second});
+        if (iter == spenders_.end() || iter->second == t.hash()) {
+            continue;
+        }
+        if (seen.insert(iter->second).second) {
+            out.push_back(iter->second);
+        }
+    }
+}
+
+void mempool::parents_locked(const tx& t, std::vector<hash256>& out, txid_set& seen) const {
+    for (auto& each : t.inputs()) {
+        if (by_id_.count(each.first) && seen.insert(each.first).second) {
+            out.push_back(each.first);
+        }
+    }
+}
+
+void mempool::ancestors_locked(const tx& t, std::vector<hash256>& out) const {
+    size_t begin = out.size();
+    txid_set seen(out.begin(), out.end());
+    parents_locked(t, out, seen);
+    for (size_t i = begin; i < out.size(); ++i) {
+        parents_locked(by_id_.at(out[i]).value, out, seen);
+    }
+}
+
+void mempool::descendants_locked(const tx& t, std::vector<hash256>& out, txid_set& seen, size_t limit) const {
+    size_t end = limit ? out.size() + limit : std::numeric_limits<size_t>::max();
+    std::vector<const tx*> pending{&t};
+    while (!pending.empty() && out.size() < end) {
+        auto current = pending.back();
+        pending.pop_back();
+        auto&& outputs = current->outputs();
+        for (uint32_t i = 0; i < outputs.size(); ++i) {
+            auto iter = spenders_.find(outpoint{current->hash(), i});
+            if (iter == spenders_.end() || !seen.insert(iter->second).second) {
+                continue;
+            }
+            out.push_back(iter->second);
+            pending.push_back(&by_id_.at(iter->second).value);
+            if (out.size() >= end) {
+                return;
+            }
+        }
+    }
+}
+
+bool mempool::descendants_fit_locked(const mempool_entry& entry, uint64_t size) const {
+    // 自身 + 已有后代 + 新交易，收集到上限即可判定
+    std::vector<hash256> descendants;
+    txid_set seen;
+    descendants_locked(entry.value, descendants, seen, MAX_DESCENDANTS - 1);
+    if (descendants.size() + 2 > MAX_DESCENDANTS) {
+        return false;
+    }
+    uint64_t total = entry.size + size;
+    for (auto& each : descendants) {
+        total += by_id_.at(each).size;
+    }
+    return total <= MAX_DESCENDANT_SIZE;
+}
+
+void mempool::trim_locked(std::vector<tx>& evicted) {
+    uint64_t max_evicted_rate = 0;
+    bool trimmed = false;
+    while (usage_ > max_usage_ && !by_priority_.empty()) {
+        auto lowest = std::prev(by_priority_.end());
+        max_evicted_rate = std::max(max_evicted_rate, lowest->fee_rate);
+        trimmed = true;
+        size_t before = evicted.size();
+        remove_tree_locked(lowest->tx_hash, evicted);
+        evictions_ += evicted.size() - before;
+    }
+    if (!trimmed) {
+        return;
+    }
+    // 之后的交易必须比被逐出的费率更高才能进入
+    auto now = clock::now();
+    uint64_t bumped = max_evicted_rate + INCREMENTAL_FEE_RATE;
+    if (bumped > min_fee_rate_locked(now)) {
+        rolling_min_fee_rate_ = bumped;
+        last_bump_ = now;
+    }
+    log::info("mempool")<<"evicted to "<<usage_<<" bytes, min fee rate "<<bumped;
+}
+
+bool mempool::contains(const hash256& tx_hash) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return by_id_.count(tx_hash) != 0;
+}
+
+bool mempool::spender(const outpoint& point, hash256& tx_hash) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    auto iter = spenders_.find(point);
+    if (iter == spenders_.end()) {
+        return false;
+    }
+    tx_hash = iter->second;
+    return true;
+}
+
+bool mempool::find_output(const outpoint& point, utxo_entry& entry) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    auto iter = by_id_.find(point.tx_hash);
+    if (iter == by_id_.end() || point.index >= iter->second.value.outputs().size()) {
+        return false;
+    }
+    auto& output = iter->second.value.outputs()[point.index];
+    entry.tx_hash = point.tx_hash;
+    entry.index = point.index;
+    entry.value = output.second;
+    entry.owner = address_hash(output.first);
+    return true;
+}
+
+bool mempool::get(const hash256& tx_hash, tx& out) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    auto iter = by_id_.find(tx_hash);
+    if (iter == by_id_.end()) {
+        return false;
+    }
+    out = iter->second.value;
+    return true;
+}
+
+bool mempool::remove_locked(const hash256& tx_hash, std::vector<tx>& removed) {
+    auto iter = by_id_.find(tx_hash);
+    if (iter == by_id_.end()) {
+        return false;
+    }
+    auto& entry = iter->second;
+    std::vector<hash256> descendants;
+    txid_set seen;
+    descendants_locked(entry.value, descendants, seen);
+    for (auto& each : descendants) {
+        auto& other = by_id_.at(each);
+        by_ancestor_score_.erase(ancestor_key_of(other));
+        other.ancestor_fee -= entry.fee;
+        other.ancestor_size -= entry.size;
+        --other.ancestor_count;
+        by_ancestor_score_.insert(ancestor_key_of(other));
+    }
+    erase_locked(iter, removed);
+    return true;
+}
+
+void mempool::erase_locked(entry_iter iter, std::vector<tx>& removed) {
+    auto& entry = iter->second;
+    usage_ -= entry.usage;
+    bytes_ -= entry.size;
+    record_locked(iter->first, false);
+    by_priority_.erase(key_of(entry));
+    by_ancestor_score_.erase(ancestor_key_of(entry));
+    for (auto& each : entry.value.inputs()) {
+        spenders_.erase(outpoint{each.first, each.second});
+    }
+    removed.push_back(std::move(entry.value));
+    by_id_.erase(iter);
+}
+
+void mempool::remove_tree_locked(const hash256& tx_hash, std::vector<tx>& removed) {
+    auto iter = by_id_.find(tx_hash);
+    if (iter == by_id_.end()) {
+        return;
+    }
+    std::vector<hash256> descendants;
+    txid_set seen;
+    descendants_locked(iter->second.value, descendants, seen);
+    // 整棵树一起移除，树外没有以树内交易为祖先的条目，不需更新祖先合计
+    for (auto each = descendants.rbegin(); each != descendants.rend(); ++each) {
+        erase_locked(by_id_.find(*each), removed);
+    }
+    erase_locked(iter, removed);
+}
+
+std::vector<tx> mempool::remove(const std::vector<hash256>& tx_hashes) {
+    std::vector<tx> removed;
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    for (auto& each : tx_hashes) {
+        remove_tree_locked(each, removed);
+    }
+    return removed;
+}
+
+void mempool::remove_for_block(const block& b, std::vector<tx>& conflicts) {
+    std::vector<tx> included;
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    // 区块内祖先在前，逐个移除时留下的后代只需扣除一次
+    for (auto& t : b.tx_list()) {
+        remove_locked(t.hash(), included);
+    }
+    // 区块交易已花费的输出，内存池中其余花费者都已失效
+    std::vector<hash256> stale;
+    txid_set seen;
+    for (auto& t : b.tx_list()) {
+        conflicts_locked(t, stale, seen);
+    }
+    for (auto& each : stale) {
+        log::info("mempool")<<"drop tx "<<each<<": conflicts with block "<<b.hash();
+        remove_tree_locked(each, conflicts);
+    }
+}
+
+std::vector<tx> mempool::select(size_t max_count) const {
+    std::vector<tx> out;
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    out.reserve(max_count ? std::min(max_count, by_id_.size()) : by_id_.size());
+    for (auto& key : by_priority_) {
+        if (max_count && out.size() >= max_count) {
+            break;
+        }
+        out.push_back(by_id_.at(key.tx_hash).value);
+    }
+    return out;
+}
+
+std::vector<mempool_entry> mempool::entries() const {
+    std::vector<mempool_entry> out;
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    out.reserve(by_id_.size());
+    for (auto& key : by_priority_) {
+        out.push_back(by_id_.at(key.tx_hash));
+    }
+    return out;
+}
+
+void mempool::record_locked(const hash256& tx_hash, bool added) {
+    ++version_;
+    journal_.push_back(change{tx_hash, added});
+    if (journal_.size() > JOURNAL_LIMIT) {
+        journal_.pop_front();
+        ++journal_version_;
+    }
+}
+
+bool mempool::select_package_locked(package_selection& sel, const mempool_entry& entry) const {
+    // 包: 尚未选中的祖先 + 自身
+    std::vector<hash256> package;
+    ancestors_locked(entry.value, package);
+    package.erase(std::remove_if(package.begin(), package.end(),
+                [&sel](const hash256& each) { return sel.selected.count(each) != 0; }), package.end());
+    package.push_back(entry.value.hash());
+    uint64_t package_size = 0;
+    for (auto& each : package) {
+        package_size += by_id_.at(each).size;
+    }
+    if (sel.bytes + package_size > sel.max_bytes) {
+        sel.saturated = true;
+        return false;
+    }
+    for (auto& each : package) {
+        sel.selected.emplace(each, by_id_.at(each).size);
+    }
+    sel.bytes += package_size;
+    sel.min_score = std::min(sel.min_score, entry.ancestor_fee_rate());
+    return true;
+}
+
+void mempool::fill_locked(package_selection& sel) const {
+    // 连续这么多个包放不下且剩余空间已很小时停止
+    static const size_t MAX_CONSECUTIVE_FAILURES = 1000;
+    static const uint64_t MIN_TX_SIZE = 64;
+
+    sel.saturated = false;
+    size_t failures = 0;
+    for (auto& key : by_ancestor_score_) {
+        if (sel.selected.count(key.tx_hash)) {
+            continue;
+        }
+        if (sel.max_bytes - sel.bytes < MIN_TX_SIZE) {
+            sel.saturated = true;
+            break;
+        }
+        if (!select_package_locked(sel, by_id_.at(key.tx_hash))) {
+            if (++failures >= MAX_CONSECUTIVE_FAILURES && sel.max_bytes - sel.bytes < sel.max_bytes / 100) {
+                break;
+            }
+            continue;
+        }
+        failures = 0;
+    }
+}
+
+selection_update mempool::update_selection(package_selection& sel, uint64_t max_bytes) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    if (sel.valid && sel.max_bytes == max_bytes && sel.version == version_) {
+        return selection_update::unchanged;
+    }
+
+    auto rebuild = [&] {
+        sel.selected.clear();
+        sel.bytes = 0;
+        sel.max_bytes = max_bytes;
+        sel.min_score = std::numeric_limits<uint64_t>::max();
+        fill_locked(sel);
+        sel.valid = true;
+        sel.version = version_;
+        return selection_update::rebuilt;
+    };
+    if (!sel.valid || sel.max_bytes != max_bytes || sel.version + 1 < journal_version_) {
+        return rebuild();
+    }
+
+    bool refill = false;
+    for (size_t i = sel.version + 1 - journal_version_; i < journal_.size(); ++i) {
+        auto& each = journal_[i];
+        if (!each.added) {
+            auto iter = sel.selected.find(each.tx_hash);
+            if (iter != sel.selected.end()) {
+                sel.bytes -= iter->second;
+                sel.selected.erase(iter);
+                refill = refill || sel.saturated;
+            }
+            continue;
+        }
+        // 之后又被移除的交易跳过
+        auto entry = by_id_.find(each.tx_hash);
+        if (entry == by_id_.end() || sel.selected.count(each.tx_hash)) {
+            continue;
+        }
+        if (!select_package_locked(sel, entry->second) && entry->second.ancestor_fee_rate() > sel.min_score) {
+            return rebuild();
+        }
+    }
+    if (refill) {
+        fill_locked(sel);
+    }
+    sel.version = version_;
+    return selection_update::incremental;
+}
+
+void mempool::selected_entries(const package_selection& sel, std::vector<mempool_entry>& out) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    size_t begin = out.size();
+    out.reserve(begin + sel.selected.size());
+    for (auto& each : sel.selected) {
+        auto iter = by_id_.find(each.first);
+        if (iter != by_id_.end()) {
+            out.push_back(iter->second);
+        }
+    }
+    // 祖先数少的在前即为拓扑序
+    std::stable_sort(out.begin() + begin, out.end(), [](const mempool_entry& a, const mempool_entry& b) {
+            return a.ancestor_count < b.ancestor_count;
+            });
+}
+
+void mempool::select_packages(uint64_t max_bytes, std::vector<mempool_entry>& out) const {
+    package_selection sel;
+    update_selection(sel, max_bytes);
+    selected_entries(sel, out);
+}
+
+uint64_t mempool::version() const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return version_;
+}
+
+void mempool::set_max_usage(size_t max_usage, std::vector<tx>& evicted) {
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    max_usage_ = max_usage;
+    trim_locked(evicted);
+}
+
+uint64_t mempool::min_fee_rate() const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return min_fee_rate_locked(clock::now());
+}
+
+size_t mempool::size() const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return by_id_.size();
+}
+
+mempool_stats mempool::stats() const {
+    mempool_stats s;
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    s.count = by_id_.size();
+    s.bytes = bytes_;
+    s.usage = usage_;
+    s.max_usage = max_usage_;
+    s.min_fee_rate = min_fee_rate_locked(clock::now());
+    s.evictions = evictions_;
+    s.rejected = rejected_;
+    s.replacements = replacements_;
+    return s;
+}
+
+}// tinychain
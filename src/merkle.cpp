@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <thread>
+#include <tinychain/merkle.hpp>
+
+namespace tinychain
+{
+
+// 超过这个对数才拆分到多个线程，避免线程创建开销大于哈希本身
+static const size_t parallel_pairs_threshold = 4096;
+
+// 64字节消息的第二个块只有填充: 0x80 ... 比特长度512
+static const std::array<unsigned char, SHA256::BLOCK_SIZE>& pair_padding() {
+    static const std::array<unsigned char, SHA256::BLOCK_SIZE> padding = []() {
+        std::array<unsigned char, SHA256::BLOCK_SIZE> p;
+        p.fill(0);
+        p[0] = 0x80;
+        p[SHA256::BLOCK_SIZE - 2] = 0x02; // 512 = 0x0200
+        return p;
+    }();
+    return padding;
+}
+
+// 计算 [begin, end) 这些父节点: parent[i] = sha256(level[2i] || level[2i+1])
+static void hash_pairs(const std::vector<hash256>& level, std::vector<hash256>& next,
+        size_t begin, size_t end) {
+    const size_t lanes = sha256_lanes();
+    std::vector<unsigned char> blocks(lanes * SHA256::BLOCK_SIZE);
+    std::vector<const unsigned char*> first(lanes), second(lanes, pair_padding().data());
+    std::vector<uint32_t> states(lanes * 8);
+
+    for (size_t i = begin; i < end; i += lanes) {
+        size_t count = std::min(lanes, end - i);
+        for (size_t k = 0; k < count; ++k) {
+            size_t left = 2 * (i + k);
+            size_t right = std::min(left + 1, level.size() - 1);
+            unsigned char* block = &blocks[k * SHA256::BLOCK_SIZE];
+            memcpy(block, level[left].data(), hash256::SIZE);
+            memcpy(block + hash256::SIZE, level[right].data(), hash256::SIZE);
+            first[k] = block;
+            SHA256::initial_state(&states[k * 8]);
+        }
+        sha256_compress_many(states.data(), first.data(), count);
+        sha256_compress_many(states.data(), second.data(), count);
+        for (size_t k = 0; k < count; ++k) {
+            SHA256::state_to_digest(&states[k * 8], next[i + k].data());
+        }
+    }
+}
+
+void merkle_next_level(const std::vector<hash256>& level, std::vector<hash256>& next) {
+    size_t pairs = (level.size() + 1) / 2;
+    next.resize(pairs);
+
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, pairs / parallel_pairs_threshold);
+    if (threads <= 1) {
+        hash_pairs(level, next, 0, pairs);
+        return;
+    }
+
+    std::vector<std::thread> workers;
+    size_t chunk = (pairs + threads - 1) / threads;
+    for (size_t begin = 0; begin < pairs; begin += chunk) {
+        workers.emplace_back(hash_pairs, std::cref(level), std::ref(next),
+                begin, std::min(begin + chunk, pairs));
+    }
+    for (auto& each : workers) {
+        each.join();
+    }
+}
+
+hash256 merkle_root(const std::vector<hash256>& leaves) {
+    if (leaves.empty()) {
+        return hash256();
+    }
+
+    std::vector<hash256> level = leaves, next;
+    while (level.size() > 1) {
+        merkle_next_level(level, next);
+        level.swap(next);
+    }
+    return level.front();
+}
+
+bool merkle_branch(const std::vector<hash256>& leaves, size_t index, merkle_proof& proof) {
+    if (index >= leaves.size()) {
+        return false;
+    }
+
+    proof.index = index;
+    proof.branch.clear();
+
+    std::vector<hash256> level = leaves, next;
+    for (size_t pos = index; level.size() > 1; pos >>= 1) {
+        size_t sibling = pos ^ 1;
+        proof.branch.push_back(level[std::min(sibling, level.size() - 1)]);
+        merkle_next_level(level, next);
+        level.swap(next);
+    }
+    return true;
+}
+
+hash256 merkle_root_from_proof(const hash256& leaf, const merkle_proof& proof) {
+    unsigned char concat[2 * hash256::SIZE];
+    hash256 node = leaf;
+    uint64_t pos = proof.index;
+    for (auto& sibling : proof.branch) {
+        const hash256& left = (pos & 1) ? sibling : node;
+        const hash256& right = (pos & 1) ? node : sibling;
+        memcpy(concat, left.data(), hash256::SIZE);
+        memcpy(concat + hash256::SIZE, right.data(), hash256::SIZE);
+        node = sha256_hash(concat, sizeof(concat));
+        pos >>= 1;
+    }
+    return node;
+}
+
+bool verify_merkle_proof(const hash256& leaf, const merkle_proof& proof, const hash256& root) {
+    // 证明长度之外不能再有多余的位置比特
+    if (proof.branch.size() < 64 && (proof.index >> proof.branch.size()) != 0) {
+        return false;
+    }
+    return merkle_root_from_proof(leaf, proof) == root;
+}
+
+}// tinychain
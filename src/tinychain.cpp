@@ -1,4 +1,6 @@
 #include <tinychain/tinychain.hpp>
+#include <tinychain/merkle.hpp>
+#include <cstring>
 #include <boost/date_time/posix_time/posix_time.hpp>
 
 
@@ -16,41 +18,241 @@ uint64_t pseudo_random(){
     return distribution(device);
 }
 
-sha256_t to_sha256(Json::Value jv){
+hash256 to_sha256(Json::Value jv){
     Json::StreamWriterBuilder builder;
     std::ostringstream oss;
     std::unique_ptr<Json::StreamWriter> writer(builder.newStreamWriter());
     writer->write(jv, &oss);
-    return sha256(oss.str());
+    return sha256_hash(oss.str());
 }
 
+void put_uint64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint64_t get_uint64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
 
-tx::tx(address_t& address) {
-    auto&& input_item = std::make_pair("00000000000000000000000000000000", 0);
-    inputs_.push_back(input_item);
+const uint8_t tx::COINBASE_INDEX;
+
+tx::tx(const address_t& address, uint64_t height, uint64_t extra_nonce) {
+    hash256 marker;
+    put_uint64(marker.data(), height);
+    put_uint64(marker.data() + 8, extra_nonce);
+    inputs_.push_back(std::make_pair(marker, COINBASE_INDEX));
 
     // build tx
-    auto&& ouput_item = std::make_pair(address, 1000);
-    outputs_.push_back(ouput_item);
+    outputs_.push_back(std::make_pair(address, coinbase_reward));
 
     // hash
-    to_json();
+    rehash();
 }
 
+tx::tx(const input_t& inputs, const output_t& outputs):inputs_(inputs), outputs_(outputs) {
+    // hash
+    rehash();
+}
 
+static void put_bytes(std::string& out, const void* data, size_t size) {
+    out.append(static_cast<const char*>(data), size);
+}
 
-tx::tx(address_t& address, uint64_t amount) {
-    //get_balance_from blokchain
-    //TODO
-    auto&& input_item = std::make_pair(sha256(address), 0);
-    inputs_.push_back(input_item);
+static void put_u64(std::string& out, uint64_t value) {
+    uint8_t buf[8];
+    put_uint64(buf, value);
+    put_bytes(out, buf, sizeof(buf));
+}
 
-    // build tx
-    auto&& ouput_item = std::make_pair(address, amount);
-    outputs_.push_back(ouput_item);
+static void put_u32(std::string& out, uint32_t value) {
+    uint8_t buf[4] = {uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24)};
+    put_bytes(out, buf, sizeof(buf));
+}
 
-    // hash
-    to_json();
+static bool get_u32(const uint8_t*& in, const uint8_t* end, uint32_t& value) {
+    if (end - in < 4) {
+        return false;
+    }
+    value = uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+    in += 4;
+    return true;
+}
+
+static bool get_u64(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+    if (end - in < 8) {
+        return false;
+    }
+    value = get_uint64(in);
+    in += 8;
+    return true;
+}
+
+static bool get_hash(const uint8_t*& in, const uint8_t* end, hash256& value) {
+    if (size_t(end - in) < hash256::SIZE) {
+        return false;
+    }
+    value = hash256(in);
+    in += hash256::SIZE;
+    return true;
+}
+
+void tx::encode(std::string& out) const {
+    put_bytes(out, hash_.data(), hash256::SIZE);
+    put_u32(out, inputs_.size());
+    for (auto& each : inputs_) {
+        put_bytes(out, each.first.data(), hash256::SIZE);
+        out.push_back(char(each.second));
+    }
+    put_u32(out, outputs_.size());
+    for (auto& each : outputs_) {
+        put_u32(out, each.first.size());
+        put_bytes(out, each.first.data(), each.first.size());
+        put_u64(out, each.second);
+    }
+}
+
+bool tx::decode(const uint8_t*& in, const uint8_t* end) {
+    uint32_t count;
+    if (!get_hash(in, end, hash_) || !get_u32(in, end, count)) {
+        return false;
+    }
+    inputs_.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        hash256 h;
+        if (!get_hash(in, end, h) || in == end) {
+            return false;
+        }
+        inputs_.push_back(std::make_pair(h, *in++));
+    }
+    if (!get_u32(in, end, count)) {
+        return false;
+    }
+    outputs_.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t len;
+        uint64_t value;
+        if (!get_u32(in, end, len) || uint64_t(end - in) < len) {
+            return false;
+        }
+        address_t address(reinterpret_cast<const char*>(in), len);
+        in += len;
+        if (!get_u64(in, end, value)) {
+            return false;
+        }
+        outputs_.push_back(std::make_pair(address, value));
+    }
+    return true;
+}
+
+std::string block::encode() const {
+    std::string out;
+    auto&& header = header_bytes();
+    put_bytes(out, header.data(), header.size());
+    put_u64(out, header_.tx_count);
+    put_bytes(out, header_.hash.data(), hash256::SIZE);
+    put_u32(out, tx_list_.size());
+    for (auto& each : tx_list_) {
+        each.encode(out);
+    }
+    return out;
+}
+
+bool block::decode(const uint8_t* data, size_t size) {
+    const uint8_t* in = data;
+    const uint8_t* end = data + size;
+    if (size < HEADER_SIZE) {
+        return false;
+    }
+    header_.prev_hash = hash256(in);
+    header_.merkel_root_hash = hash256(in + 32);
+    header_.timestamp = get_uint64(in + 64);
+    header_.difficulty = get_uint64(in + 72);
+    header_.height = get_uint64(in + 80);
+    header_.nonce = get_uint64(in + NONCE_OFFSET);
+    in += HEADER_SIZE;
+
+    uint32_t count;
+    if (!get_u64(in, end, header_.tx_count) || !get_hash(in, end, header_.hash) || !get_u32(in, end, count)) {
+        return false;
+    }
+    tx_list_.clear();
+    tx_list_.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        tx t;
+        if (!t.decode(in, end)) {
+            return false;
+        }
+        tx_list_.push_back(std::move(t));
+    }
+    return in == end;
+}
+
+bool block::scan(const uint8_t* data, size_t size, hash256& hash, std::vector<hash256>& tx_hashes) {
+    const uint8_t* in = data + HEADER_SIZE + 8;
+    const uint8_t* end = data + size;
+    uint32_t count;
+    if (size < HEADER_SIZE + 8 || !get_hash(in, end, hash) || !get_u32(in, end, count)) {
+        return false;
+    }
+    tx_hashes.clear();
+    for (uint32_t i = 0; i < count; ++i) {
+        hash256 h;
+        uint32_t n;
+        if (!get_hash(in, end, h) || !get_u32(in, end, n) || uint64_t(end - in) < uint64_t(n) * (hash256::SIZE + 1)) {
+            return false;
+        }
+        tx_hashes.push_back(h);
+        in += n * (hash256::SIZE + 1);
+        if (!get_u32(in, end, n)) {
+            return false;
+        }
+        for (uint32_t k = 0; k < n; ++k) {
+            uint32_t len;
+            if (!get_u32(in, end, len) || uint64_t(end - in) < uint64_t(len) + 8) {
+                return false;
+            }
+            in += len + 8;
+        }
+    }
+    return in == end;
+}
+
+block::header_bytes_t block::header_bytes() const {
+    header_bytes_t out;
+    memcpy(&out[0], header_.prev_hash.data(), hash256::SIZE);
+    memcpy(&out[32], header_.merkel_root_hash.data(), hash256::SIZE);
+    put_uint64(&out[64], header_.timestamp);
+    put_uint64(&out[72], header_.difficulty);
+    put_uint64(&out[80], header_.height);
+    put_uint64(&out[NONCE_OFFSET], header_.nonce);
+    return out;
+}
+
+hash256 block::header_hash() const {
+    auto&& bytes = header_bytes();
+    return sha256_hash(bytes.data(), bytes.size());
+}
+
+void block::setup(tx_list_t& txs) {
+    tx_list_.swap(txs);
+    header_.tx_count = tx_list_.size();
+
+    header_.merkel_root_hash = merkle_root(tx_hashes());
+}
+
+std::vector<hash256> block::tx_hashes() const {
+    std::vector<hash256> hashes;
+    hashes.reserve(tx_list_.size());
+    for (auto& each : tx_list_) {
+        hashes.push_back(each.hash());
+    }
+    return hashes;
 }
 
 } //tinychain
@@ -0,0 +1,236 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <tinychain/tx_index.hpp>
+#include <tinychain/tinychain.hpp>
+
+namespace tinychain
+{
+
+// ---------------------------- bloom_filter ----------------------------
+bloom_filter::bloom_filter(size_t capacity):capacity_(capacity) {
+    bits_.assign((capacity_ * bits_per_item + 63) / 64, 0);
+}
+
+void bloom_filter::clear() {
+    std::fill(bits_.begin(), bits_.end(), 0);
+}
+
+// 双重哈希: 第i个探测位为 h1 + i*h2
+static inline void bloom_seeds(const hash256& h, uint64_t& h1, uint64_t& h2) {
+    memcpy(&h1, h.data(), sizeof(h1));
+    memcpy(&h2, h.data() + 8, sizeof(h2));
+    h2 |= 1;
+}
+
+void bloom_filter::insert(const hash256& h) {
+    uint64_t h1, h2;
+    bloom_seeds(h, h1, h2);
+    const uint64_t nbits = bits_.size() * 64;
+    for (size_t i = 0; i < probes; ++i) {
+        uint64_t bit = (h1 + i * h2) % nbits;
+        bits_[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+}
+
+bool bloom_filter::may_contain(const hash256& h) const {
+    uint64_t h1, h2;
+    bloom_seeds(h, h1, h2);
+    const uint64_t nbits = bits_.size() * 64;
+    for (size_t i = 0; i < probes; ++i) {
+        uint64_t bit = (h1 + i * h2) % nbits;
+        if (!(bits_[bit >> 6] & (uint64_t(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// ---------------------------- tx_index ----------------------------
+const size_t tx_index::RECORD_SIZE;
+const size_t tx_index::HEADER_SIZE;
+const uint32_t tx_index::MAGIC;
+const uint32_t tx_index::VERSION;
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+    return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+tx_index::~tx_index() {
+    close();
+}
+
+void tx_index::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool tx_index::open(const std::string& path, uint64_t count, uint64_t& covered) {
+    covered = 0;
+    fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (fd_ < 0 || ::fstat(fd_, &st) != 0) {
+        log::error("tx_index")<<"open "<<path<<" failed: "<<strerror(errno);
+        close();
+        return false;
+    }
+
+    // 有效前缀: 文件头正确，记录高度不递减且小于count
+    size_t size = st.st_size;
+    size_t keep = 0;
+    void* map = size ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0) : MAP_FAILED;
+    if (map != MAP_FAILED) {
+        auto in = static_cast<const uint8_t*>(map);
+        if (size >= HEADER_SIZE && get_u32(in) == MAGIC && get_u32(in + 4) == VERSION) {
+            const uint8_t* records = in + HEADER_SIZE;
+            size_t total = (size - HEADER_SIZE) / RECORD_SIZE;
+            size_t valid = 0;
+            uint64_t last = 0;
+            for (; valid < total; ++valid) {
+                uint64_t height = get_uint64(records + valid * RECORD_SIZE + hash256::SIZE);
+                if (height < last || height >= count) {
+                    break;
+                }
+                last = height;
+            }
+            covered = valid ? last : 0;
+            while (keep < valid && get_uint64(records + keep * RECORD_SIZE + hash256::SIZE) < covered) {
+                ++keep;
+            }
+            load(records, keep);
+        } else {
+            log::warning("tx_index")<<path<<": bad header, rebuilding";
+        }
+        ::munmap(map, size);
+    }
+
+    // 截掉不完整的尾部，之后从文件末尾追加
+    uint8_t header[HEADER_SIZE];
+    put_u32(header, MAGIC);
+    put_u32(header + 4, VERSION);
+    size_t end = HEADER_SIZE + keep * RECORD_SIZE;
+    if (::ftruncate(fd_, end) != 0 || ::pwrite(fd_, header, HEADER_SIZE, 0) != ssize_t(HEADER_SIZE)
+            || ::lseek(fd_, end, SEEK_SET) < 0) {
+        log::error("tx_index")<<"truncate "<<path<<" failed: "<<strerror(errno);
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool tx_index::append(const std::vector<hash256>& tx_hashes, uint64_t height) {
+    if (fd_ < 0) {
+        return false;
+    }
+    std::vector<uint8_t> buf(tx_hashes.size() * RECORD_SIZE);
+    for (uint32_t i = 0; i < tx_hashes.size(); ++i) {
+        encode(tx_hashes[i], tx_location{height, i}, &buf[i * RECORD_SIZE]);
+    }
+    // 写了一半的记录之后不能再追加，否则重启时整个尾部错位
+    if (!write_all(fd_, buf.data(), buf.size())) {
+        log::error("tx_index")<<"append failed: "<<strerror(errno)<<", stop persisting";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void tx_index::put(const hash256& tx_hash, const tx_location& location) {
+    index_[tx_hash] = location;
+    if (!use_bloom_) {
+        return;
+    }
+    if (index_.size() > bloom_.capacity()) {
+        grow_bloom();
+    } else {
+        bloom_.insert(tx_hash);
+    }
+}
+
+bool tx_index::get(const hash256& tx_hash, tx_location& location) const {
+    if (use_bloom_ && !bloom_.may_contain(tx_hash)) {
+        return false;
+    }
+    auto iter = index_.find(tx_hash);
+    if (iter == index_.end()) {
+        bloom_false_positives_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    location = iter->second;
+    return true;
+}
+
+// 超出容量后误判率上升，按两倍容量重建
+void tx_index::grow_bloom() {
+    bloom_ = bloom_filter(bloom_.capacity() * 2);
+    for (auto& each : index_) {
+        bloom_.insert(each.first);
+    }
+}
+
+void tx_index::encode(const hash256& tx_hash, const tx_location& location, uint8_t* out) {
+    memcpy(out, tx_hash.data(), hash256::SIZE);
+    put_uint64(out + hash256::SIZE, location.height);
+    for (int i = 0; i < 4; ++i) {
+        out[hash256::SIZE + 8 + i] = uint8_t(location.position >> (8 * i));
+    }
+}
+
+void tx_index::decode(const uint8_t* in, hash256& tx_hash, tx_location& location) {
+    tx_hash = hash256(in);
+    location.height = get_uint64(in + hash256::SIZE);
+    location.position = 0;
+    for (int i = 3; i >= 0; --i) {
+        location.position = (location.position << 8) | in[hash256::SIZE + 8 + i];
+    }
+}
+
+void tx_index::load(const uint8_t* records, size_t count) {
+    // 一次分配到位，避免载入过程中反复rehash和重建过滤器
+    size_t total = index_.size() + count;
+    index_.reserve(total);
+    if (use_bloom_ && total > bloom_.capacity()) {
+        size_t capacity = bloom_.capacity();
+        while (capacity < total) {
+            capacity *= 2;
+        }
+        bloom_ = bloom_filter(capacity);
+        for (auto& each : index_) {
+            bloom_.insert(each.first);
+        }
+    }
+    hash256 tx_hash;
+    tx_location location;
+    for (size_t i = 0; i < count; ++i) {
+        decode(records + i * RECORD_SIZE, tx_hash, location);
+        put(tx_hash, location);
+    }
+}
+
+}// tinychain
@@ -0,0 +1,666 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <tinychain/utxo.hpp>
+
+namespace tinychain
+{
+
+const uint32_t utxo_entry::OCCUPIED;
+const uint32_t utxo_entry::COINBASE;
+const size_t utxo_entry::RECORD_SIZE;
+const uint32_t utxo_snapshot::MAGIC;
+const uint32_t utxo_snapshot::VERSION;
+const size_t utxo_snapshot::HEADER_SIZE;
+
+static void put_u32(uint8_t* out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t* in) {
+    return uint32_t(in[0]) | uint32_t(in[1]) << 8 | uint32_t(in[2]) << 16 | uint32_t(in[3]) << 24;
+}
+
+void utxo_entry::encode(uint8_t* out) const {
+    memcpy(out, tx_hash.data(), hash256::SIZE);
+    put_u32(out + 32, index);
+    put_u32(out + 36, flags);
+    put_uint64(out + 40, value);
+    put_uint64(out + 48, height);
+    memcpy(out + 56, owner.data(), hash256::SIZE);
+}
+
+void utxo_entry::decode(const uint8_t* in) {
+    tx_hash = hash256(in);
+    index = get_u32(in + 32);
+    flags = get_u32(in + 36);
+    value = get_uint64(in + 40);
+    height = get_uint64(in + 48);
+    owner = hash256(in + 56);
+}
+
+hash256 address_hash(const address_t& address) {
+    return sha256_hash(address);
+}
+
+// ---------------------------- utxo_table ----------------------------
+static size_t round_up_pow2(size_t n) {
+    size_t p = 16;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+utxo_table::utxo_table(size_t capacity) {
+    slots_.resize(round_up_pow2(capacity));
+    mask_ = slots_.size() - 1;
+}
+
+size_t utxo_table::home(const outpoint& point) const {
+    return std::hash<outpoint>()(point) & mask_;
+}
+
+const utxo_entry* utxo_table::find(const outpoint& point) const {
+    for (size_t i = home(point); ; i = (i + 1) & mask_) {
+        auto& slot = slots_[i];
+        if (!slot.occupied()) {
+            return nullptr;
+        }
+        if (slot.index == point.index && slot.tx_hash == point.tx_hash) {
+            return &slot;
+        }
+    }
+}
+
+bool utxo_table::insert(const utxo_entry& entry) {
+    // 负载因子上限3/4
+    if ((size_ + 1) * 4 > slots_.size() * 3) {
+        grow();
+    }
+    auto&& point = entry.point();
+    for (size_t i = home(point); ; i = (i + 1) & mask_) {
+        auto& slot = slots_[i];
+        if (!slot.occupied()) {
+            slot = entry;
+            slot.flags |= utxo_entry::OCCUPIED;
+            ++size_;
+            return true;
+        }
+        if (slot.index == point.index && slot.tx_hash == point.tx_hash) {
+            return false;
+        }
+    }
+}
+
+bool utxo_table::erase(const outpoint& point) {
+    size_t i = home(point);
+    for (; ; i = (i + 1) & mask_) {
+        if (!slots_[i].occupied()) {
+            return false;
+        }
+        if (slots_[i].point() == point) {
+            break;
+        }
+    }
+
+    // 后移: 把探测链上后面能回填的条目搬到空位，保持查找不断链
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask_; slots_[j].occupied(); j = (j + 1) & mask_) {
+        size_t h = home(slots_[j].point());
+        // h 不在 (hole, j] 区间内时，条目j可以移到hole
+        bool movable = (hole <= j) ? (h <= hole || h > j) : (h <= hole && h > j);
+        if (movable) {
+            slots_[hole] = slots_[j];
+            hole = j;
+        }
+    }
+    slots_[hole] = utxo_entry();
+    --size_;
+    return true;
+}
+
+void utxo_table::reserve(size_t count) {
+    // 保持负载因子不超过3/4
+    size_t capacity = round_up_pow2(count * 4 / 3 + 1);
+    if (capacity <= slots_.size()) {
+        return;
+    }
+    std::vector<utxo_entry> old;
+    old.swap(slots_);
+    slots_.resize(capacity);
+    mask_ = slots_.size() - 1;
+    size_ = 0;
+    for (auto& each : old) {
+        if (each.occupied()) {
+            insert(each);
+        }
+    }
+}
+
+void utxo_table::clear() {
+    std::vector<utxo_entry> empty(1024);
+    slots_.swap(empty);
+    mask_ = slots_.size() - 1;
+    size_ = 0;
+}
+
+void utxo_table::grow() {
+    std::vector<utxo_entry> old;
+    old.swap(slots_);
+    slots_.resize(old.size() * 2);
+    mask_ = slots_.size() - 1;
+    size_ = 0;
+    for (auto& each : old) {
+        if (each.occupied()) {
+            insert(each);
+        }
+    }
+}
+
+// ---------------------------- utxo_set ----------------------------
+bool utxo_set::check_tx_locked(const tx& t, uint64_t& fee, const output_lookup& unconfirmed) const {
+    auto&& outputs = t.outputs();
+    if (outputs.size() >= tx::COINBASE_INDEX) {
+        return false;
+    }
+
+    uint64_t input_value = 0;
+    std::unordered_set<outpoint> seen;
+    for (auto& each : t.inputs()) {
+        outpoint point{each.first, each.second};
+        if (!seen.insert(point).second) {
+            return false;
+        }
+        auto entry = table_.find(point);
+        if (entry != nullptr) {
+            input_value += entry->value;
+            continue;
+        }
+        utxo_entry pending;
+        if (!unconfirmed || !unconfirmed(point, pending)) {
+            return false;
+        }
+        input_value += pending.value;
+    }
+
+    uint64_t output_value = t.output_value();
+    if (input_value < output_value) {
+        return false;
+    }
+    fee = input_value - output_value;
+    return true;
+}
+
+bool utxo_set::check_tx(const tx& t, uint64_t& fee, const output_lookup& unconfirmed) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    if (t.is_coinbase()) {
+        return false;
+    }
+    return check_tx_locked(t, fee, unconfirmed);
+}
+
+bool utxo_set::apply_block(const block& b, uint64_t height, const std::function<bool()>& commit) {
+    // 只有apply_block和load修改table_，校验期间持共享锁，读者不被阻塞
+    std::unique_lock<std::mutex> apply_lock(apply_lock_);
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+
+    // 先在暂存区完成全部校验，块内交易可以花费块内更早的输出
+    std::unordered_map<outpoint, utxo_entry> created;
+    std::unordered_set<outpoint> spent;
+    uint64_t fees = 0;
+    uint64_t coinbase_value = 0;
+    size_t coinbase_count = 0;
+
+    for (auto& t : b.tx_list()) {
+        if (t.is_coinbase()) {
+            ++coinbase_count;
+            coinbase_value += t.output_value();
+        } else {
+            uint64_t input_value = 0;
+            for (auto& each : t.inputs()) {
+                outpoint point{each.first, each.second};
+                if (!spent.insert(point).second) {
+                    return false;
+                }
+                auto iter = created.find(point);
+                if (iter != created.end()) {
+                    input_value += iter->second.value;
+                    created.erase(iter);
+                    continue;
+                }
+                auto entry = table_.find(point);
+                if (entry == nullptr) {
+                    return false;
+                }
+                input_value += entry->value;
+            }
+            if (input_value < t.output_value()) {
+                return false;
+            }
+            fees += input_value - t.output_value();
+        }
+
+        auto&& outputs = t.outputs();
+        if (outputs.size() >= tx::COINBASE_INDEX) {
+            return false;
+        }
+        for (uint32_t i = 0; i < outputs.size(); ++i) {
+            utxo_entry entry;
+            entry.tx_hash = t.hash();
+            entry.index = i;
+            entry.flags = t.is_coinbase() ? utxo_entry::COINBASE : 0;
+            entry.value = outputs[i].second;
+            entry.height = height;
+            entry.owner = address_hash(outputs[i].first);
+            if (!created.emplace(entry.point(), entry).second || table_.find(entry.point()) != nullptr) {
+                return false;
+            }
+        }
+    }
+
+    if (coinbase_count > 1 || coinbase_value > coinbase_reward + fees) {
+        return false;
+    }
+    if (commit && !commit()) {
+        return false;
+    }
+
+    // 提交: 只在修改内存表时独占
+    lock.unlock();
+    std::unique_lock<std::shared_timed_mutex> write_lock(lock_);
+    for (auto& each : spent) {
+        auto entry = table_.find(each);
+        if (entry != nullptr) {
+            index_remove(*entry);
+            table_.erase(each);
+        }
+    }
+    for (auto& each : created) {
+        table_.insert(each.second);
+        index_add(each.second);
+    }
+    for (auto& t : b.tx_list()) {
+        remove_pending_locked(t);
+    }
+    tip_height_ = height;
+    tip_hash_ = b.hash();
+    return true;
+}
+
+void utxo_set::index_add(const utxo_entry& entry) {
+    auto& item = by_owner_[entry.owner];
+    item.points.push_back(entry.point());
+    item.balance.confirmed += entry.value;
+}
+
+void utxo_set::index_remove(const utxo_entry& entry) {
+    auto iter = by_owner_.find(entry.owner);
+    if (iter == by_owner_.end()) {
+        return;
+    }
+    auto& points = iter->second.points;
+    auto&& point = entry.point();
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (points[i] == point) {
+            points[i] = points.back();
+            points.pop_back();
+            break;
+        }
+    }
+    iter->second.balance.confirmed -= entry.value;
+    index_release(entry.owner);
+}
+
+void utxo_set::index_release(const hash256& owner) {
+    auto iter = by_owner_.find(owner);
+    if (iter == by_owner_.end()) {
+        return;
+    }
+    auto& item = iter->second;
+    if (item.points.empty() && item.balance.pending_in == 0 && item.balance.pending_out == 0) {
+        by_owner_.erase(iter);
+    }
+}
+
+void utxo_set::add_pending(const tx& t, const output_lookup& unconfirmed) {
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    if (!pending_txs_.insert(t.hash()).second) {
+        return;
+    }
+    for (auto& each : t.inputs()) {
+        outpoint point{each.first, each.second};
+        if (pending_spent_.count(point)) {
+            continue;
+        }
+        // 花费未确认输出时抵消其所有者的待确认收入
+        utxo_entry pending;
+        auto entry = table_.find(point);
+        if (entry == nullptr) {
+            if (!unconfirmed || !unconfirmed(point, pending)) {
+                continue;
+            }
+            entry = &pending;
+        }
+        pending_spent_[point] = pending_spend{entry->owner, entry->value};
+        by_owner_[entry->owner].balance.pending_out += entry->value;
+    }
+    for (auto& each : t.outputs()) {
+        by_owner_[address_hash(each.first)].balance.pending_in += each.second;
+    }
+}
+
+void utxo_set::remove_pending(const tx& t) {
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    remove_pending_locked(t);
+}
+
+void utxo_set::remove_pending_locked(const tx& t) {
+    if (pending_txs_.erase(t.hash()) == 0) {
+        return;
+    }
+    for (auto& each : t.inputs()) {
+        auto iter = pending_spent_.find(outpoint{each.first, each.second});
+        if (iter == pending_spent_.end()) {
+            continue;
+        }
+        by_owner_[iter->second.owner].balance.pending_out -= iter->second.value;
+        index_release(iter->second.owner);
+        pending_spent_.erase(iter);
+    }
+    for (auto& each : t.outputs()) {
+        auto&& owner = address_hash(each.first);
+        by_owner_[owner].balance.pending_in -= each.second;
+        index_release(owner);
+    }
+}
+
+bool utxo_set::pending_spent(const outpoint& point) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return pending_spent_.count(point) != 0;
+}
+
+bool utxo_set::get(const outpoint& point, utxo_entry& entry) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    auto found = table_.find(point);
+    if (found == nullptr) {
+        return false;
+    }
+    entry = *found;
+    return true;
+}
+
+uint64_t utxo_set::balance(const address_t& address) const {
+    return get_balance(address).confirmed;
+}
+
+address_balance utxo_set::get_balance(const address_t& address) const {
+    auto&& owner = address_hash(address);
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    auto iter = by_owner_.find(owner);
+    if (iter == by_owner_.end()) {
+        return address_balance();
+    }
+    return iter->second.balance;
+}
+
+std::vector<utxo_entry> utxo_set::list(const address_t& address) const {
+    auto&& owner = address_hash(address);
+    std::vector<utxo_entry> out;
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    auto iter = by_owner_.find(owner);
+    if (iter == by_owner_.end()) {
+        return out;
+    }
+    out.reserve(iter->second.points.size());
+    for (auto& each : iter->second.points) {
+        auto entry = table_.find(each);
+        if (entry != nullptr) {
+            out.push_back(*entry);
+        }
+    }
+    return out;
+}
+
+size_t utxo_set::size() const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return table_.size();
+}
+
+uint64_t utxo_set::tip_height() const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return tip_height_;
+}
+
+hash256 utxo_set::tip_hash() const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    return tip_hash_;
+}
+
+void utxo_set::export_entries(std::vector<utxo_entry>& entries, uint64_t& height, hash256& tip) const {
+    std::shared_lock<std::shared_timed_mutex> lock(lock_);
+    entries.clear();
+    entries.reserve(table_.size());
+    table_.for_each([&entries](const utxo_entry& each) {
+            entries.push_back(each);
+            });
+    height = tip_height_;
+    tip = tip_hash_;
+}
+
+void utxo_set::load(const uint8_t* records, size_t count, uint64_t height, const hash256& tip) {
+    std::unique_lock<std::mutex> apply_lock(apply_lock_);
+    std::unique_lock<std::shared_timed_mutex> lock(lock_);
+    table_.clear();
+    by_owner_.clear();
+    pending_spent_.clear();
+    pending_txs_.clear();
+
+    table_.reserve(count);
+    utxo_entry entry;
+    for (size_t i = 0; i < count; ++i) {
+        entry.decode(records + i * utxo_entry::RECORD_SIZE);
+        if (table_.insert(entry)) {
+            index_add(entry);
+        }
+    }
+    tip_height_ = height;
+    tip_hash_ = tip;
+}
+
+void utxo_set::clear() {
+    load(nullptr, 0, 0, hash256());
+}
+
+// ---------------------------- utxo_snapshot ----------------------------
+static std::string snapshot_name(uint64_t height) {
+    char name[48];
+    snprintf(name, sizeof(name), "utxo_%010llu.snap", static_cast<unsigned long long>(height));
+    return name;
+}
+
+static bool write_all(int fd, const uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool utxo_snapshot::write(const std::string& dir, uint64_t height, const hash256& tip,
+        const std::vector<utxo_entry>& entries, size_t keep) {
+    auto&& path = dir + "/" + snapshot_name(height);
+    auto&& tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        log::error("utxo_snapshot")<<"open "<<tmp<<" failed: "<<strerror(errno);
+        return false;
+    }
+
+    uint8_t header[HEADER_SIZE];
+    put_u32(header, MAGIC);
+    put_u32(header + 4, VERSION);
+    put_uint64(header + 8, height);
+    memcpy(header + 16, tip.data(), hash256::SIZE);
+    put_uint64(header + 16 + hash256::SIZE, entries.size());
+    bool ok = write_all(fd, header, sizeof(header));
+
+    // 分批编码，避免一次分配整个文件大小的缓冲
+    std::vector<uint8_t> buf(4096 * utxo_entry::RECORD_SIZE);
+    for (size_t i = 0; ok && i < entries.size(); ) {
+        size_t n = std::min<size_t>(4096, entries.size() - i);
+        for (size_t k = 0; k < n; ++k) {
+            entries[i + k].encode(&buf[k * utxo_entry::RECORD_SIZE]);
+        }
+        ok = write_all(fd, buf.data(), n * utxo_entry::RECORD_SIZE);
+        i += n;
+    }
+    ok = ok && ::fsync(fd) == 0;
+    ::close(fd);
+    if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+        log::error("utxo_snapshot")<<"write "<<path<<" failed: "<<strerror(errno);
+        ::unlink(tmp.c_str());
+        return false;
+    }
+    int dir_fd = ::open(dir.c_str(), O_RDONLY);
+    if (dir_fd >= 0) {
+        ::fsync(dir_fd);
+        ::close(dir_fd);
+    }
+
+    // 只保留最新的keep个
+    auto&& all = list(dir);
+    for (size_t i = keep; i < all.size(); ++i) {
+        ::unlink(all[i].c_str());
+    }
+    log::info("utxo_snapshot")<<"wrote "<<path<<" with "<<entries.size()<<" entries";
+    return true;
+}
+
+bool utxo_snapshot::load(const std::string& path, utxo_set& set, uint64_t& height, hash256& tip) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || size_t(st.st_size) < HEADER_SIZE) {
+        ::close(fd);
+        return false;
+    }
+    void* map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    auto in = static_cast<const uint8_t*>(map);
+    uint64_t count = get_uint64(in + 16 + hash256::SIZE);
+    bool ok = get_u32(in) == MAGIC && get_u32(in + 4) == VERSION
+        && uint64_t(st.st_size) == HEADER_SIZE + count * utxo_entry::RECORD_SIZE;
+    if (ok) {
+        ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+        height = get_uint64(in + 8);
+        tip = hash256(in + 16);
+        set.load(in + HEADER_SIZE, count, height, tip);
+    } else {
+        log::warning("utxo_snapshot")<<path<<": bad header or truncated";
+    }
+    ::munmap(map, st.st_size);
+    return ok;
+}
+
+std::vector<std::string> utxo_snapshot::list(const std::string& dir) {
+    std::vector<std::string> names;
+    DIR* d = ::opendir(dir.c_str());
+    if (d == nullptr) {
+        return names;
+    }
+    while (auto entry = ::readdir(d)) {
+        std::string name = entry->d_name;
+        // utxo_ + 10位高度 + .snap
+        if (name.size() == 20 && name.compare(0, 5, "utxo_") == 0 && name.compare(15, 5, ".snap") == 0) {
+            names.push_back(name);
+        }
+    }
+    ::closedir(d);
+    // 高度定宽补零，按名字倒序即从新到旧
+    std::sort(names.rbegin(), names.rend());
+    for (auto& each : names) {
+        each = dir + "/" + each;
+    }
+    return names;
+}
+
+// ---------------------------- utxo_snapshot_writer ----------------------------
+utxo_snapshot_writer::~utxo_snapshot_writer() {
+    stop();
+}
+
+void utxo_snapshot_writer::start(const std::string& dir) {
+    std::unique_lock<std::mutex> lock(lock_);
+    if (thread_.joinable()) {
+        return;
+    }
+    dir_ = dir;
+    stop_ = false;
+    thread_ = std::thread(&utxo_snapshot_writer::run, this);
+}
+
+void utxo_snapshot_writer::stop() {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        stop_ = true;
+    }
+    cond_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void utxo_snapshot_writer::submit(uint64_t height, const hash256& tip, std::vector<utxo_entry>&& entries) {
+    {
+        std::unique_lock<std::mutex> lock(lock_);
+        height_ = height;
+        tip_ = tip;
+        entries_.swap(entries);
+        has_job_ = true;
+    }
+    cond_.notify_one();
+}
+
+void utxo_snapshot_writer::run() {
+    std::unique_lock<std::mutex> lock(lock_);
+    for (;;) {
+        cond_.wait(lock, [this] { return stop_ || has_job_; });
+        if (!has_job_) {
+            return;
+        }
+        std::vector<utxo_entry> entries;
+        entries.swap(entries_);
+        uint64_t height = height_;
+        hash256 tip = tip_;
+        has_job_ = false;
+
+        lock.unlock();
+        utxo_snapshot::write(dir_, height, tip, entries);
+        lock.lock();
+    }
+}
+
+}// tinychain
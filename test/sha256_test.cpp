@@ -0,0 +1,25 @@
+#include <cstdio>
+#include <tinychain/sha256.hpp>
+
+using namespace tinychain;
+
+// 每个编译进来的单消息后端都与标准测试向量及标量实现逐位一致，多路内核与单消息结果一致
+// CPU不支持的后端跳过；任一不一致返回非0
+
+int main() {
+    int failed = 0;
+    auto check = [&failed](const char* name, bool ok) {
+        printf("%-24s %s\n", name, ok ? "ok" : "FAILED");
+        failed += !ok;
+    };
+
+    check("scalar", sha256_self_test_backend(SHA256::compress_generic));
+    if (SHA256::shani_supported()) {
+        check("sha-ni", sha256_self_test_backend(SHA256::compress_shani));
+    } else {
+        printf("%-24s skipped, not supported by this cpu\n", "sha-ni");
+    }
+    printf("selected: %s, multi-buffer: %s x%zu\n", SHA256::backend(), sha256_backend(), sha256_lanes());
+    check("selected + multi-buffer", sha256_self_test());
+    return failed ? 1 : 0;
+}